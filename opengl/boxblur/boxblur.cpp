@@ -21,69 +21,255 @@
 #include <iterator>
 #include <numeric>
 #include <chrono>
+#include <functional>
+#include <algorithm>
 
 #include "helper.h"
 #include "gl_helper.h"
+#include "image_writer.h"
+#include "png_gpu_filter.h"
+#include "stream_helper.h"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "image_loader.h"
+#include "jpeg_gpu_decoder.h"
 
+// Bind 'inTex' to image unit 0 and 'outTex' to image unit 1 and run 'program' in 16x16-size workgroups
+void dispatchImageKernel(GLuint program, GLuint inTex, GLuint outTex, int w, int h)
+{
+    glState().bindImageTexture(0, inTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+    glState().bindImageTexture(1, outTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+    glState().useProgram(program);
+    glBarriers().textureAccess(inTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBarriers().textureAccess(outTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    int localSize = 16;
+    glDispatchCompute((w + localSize - 1) / localSize, (h + localSize - 1) / localSize, 1);
+    glBarriers().imageWritten(outTex);
+}
 
-int main()
+// Compare the fused grayscale + blur kernel with convert2gray and boxblur run back to back,
+// with and without the CPU round trip of the intermediate image
+void benchmarkFusion(GLuint fusedHandle, GLuint blurHandle, GLuint inTex, int w, int h, int radius, int iterations)
 {
+    GLuint grayHandle = createComputeShader("convert2gray.comp");
+    GLuint midTex = createTextureStorage(2, GL_READ_WRITE, w, h);
+    GLuint twoPassTex = createTextureStorage(2, GL_READ_WRITE, w, h);
+    GLuint fusedTex = createTextureStorage(2, GL_READ_WRITE, w, h);
+
+    // Global memory traffic per pixel: 4 bytes per RGBA8 access, the blur loads
+    // a (16 + 2 * radius)^2 tile per 16x16 pixels
+    double pixels = static_cast<double>(w) * h;
+    double tileWithBorder = 16.0 + 2.0 * radius;
+    double tileLoad = 4.0 * (tileWithBorder * tileWithBorder) / (16.0 * 16.0);
+    double grayBytes = pixels * (4.0 + 4.0);
+    double blurBytes = pixels * (tileLoad + 4.0);
+    double fusedBytes = blurBytes;
+
+    struct Variant
+    {
+        const char *name;
+        double deviceBytes;
+        double transferBytes;
+        std::function<void()> run;
+    };
+    std::vector<Variant> variants = {
+        {"gray + blur (CPU round trip)", grayBytes + blurBytes, pixels * 8.0, [&]() {
+             dispatchImageKernel(grayHandle, inTex, midTex, w, h);
+             auto gray = readTextureStorage(midTex, 4, w, h);
+             updateTexture2D(midTex, w, h, GL_RGBA_INTEGER, gray.data());
+             dispatchImageKernel(blurHandle, midTex, twoPassTex, w, h);
+         }},
+        {"gray + blur (two dispatches)", grayBytes + blurBytes, 0.0, [&]() {
+             dispatchImageKernel(grayHandle, inTex, midTex, w, h);
+             dispatchImageKernel(blurHandle, midTex, twoPassTex, w, h);
+         }},
+        {"fused gray + blur", fusedBytes, 0.0, [&]() {
+             dispatchImageKernel(fusedHandle, inTex, fusedTex, w, h);
+         }},
+    };
+
+    printf("\n");
+    printf("========== Fusion benchmark (%ix%i, %i iterations) ==========\n", w, h, iterations);
+    printf("%-30s %12s %12s %14s %14s %12s\n", "variant", "GPU ms", "wall ms", "device MB", "transfer MB", "GB/s");
+    GLTime gpuTime;
+    for (auto &variant : variants)
+    {
+        variant.run(); // warmup
+        glFinish();
+        double gpuMs = 0.0;
+        double wallMs = 0.0;
+        for (int i = 0; i < iterations; ++i)
+        {
+            auto tStart = std::chrono::high_resolution_clock::now();
+            gpuTime.start();
+            variant.run();
+            gpuTime.end();
+            glFinish();
+            auto tEnd = std::chrono::high_resolution_clock::now();
+            gpuMs += gpuTime.timeInMs();
+            wallMs += std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+        }
+        gpuMs /= iterations;
+        wallMs /= iterations;
+        // Drivers without timer query support report ~0 ms, use the wall time for the bandwidth then
+        double bandwidthMs = gpuMs > 1e-3 ? gpuMs : wallMs;
+        printf("%-30s %12f %12f %14.2f %14.2f %12.2f\n", variant.name, gpuMs, wallMs,
+               variant.deviceBytes * 1e-6, variant.transferBytes * 1e-6, variant.deviceBytes / (bandwidthMs * 1e6));
+    }
+    printf("Device traffic saved by fusion = %.2f MB per image (%.0f%%)\n",
+           (grayBytes + blurBytes - fusedBytes) * 1e-6, 100.0 * (grayBytes + blurBytes - fusedBytes) / (grayBytes + blurBytes));
+
+    // Both paths must produce the same image
+    auto twoPass = readTextureStorage(twoPassTex, 4, w, h);
+    auto fused = readTextureStorage(fusedTex, 4, w, h);
+    int maxDiff = 0;
+    for (size_t i = 0; i < fused.size(); ++i)
+    {
+        maxDiff = std::max(maxDiff, std::abs(static_cast<int>(fused[i]) - static_cast<int>(twoPass[i])));
+    }
+    printf("Max difference between fused and two-pass images = %i\n", maxDiff);
+    printf("============================================================\n");
+
+    glState().deleteTextures(1, &midTex);
+    glState().deleteTextures(1, &twoPassTex);
+    glState().deleteTextures(1, &fusedTex);
+    glState().deleteProgram(grayHandle);
+}
+
+int main(int argc, char **argv)
+{
+    // Decode the input image into the image cache, later runs map the pixels
+    if (hasOption(argc, argv, "--prewarm-cache"))
+    {
+        return prewarmImageCache({getBinDirectory() + "landscape.jpg"}) == 0 ? 0 : 1;
+    }
+
+    // Blur radius is a compile-time constant of the kernels, checked before creating the context.
+    // The (16 + 2 * radius)^2 uvec4 tile must fit in the 32 KB of shared memory every GPU has.
+    const int maxRadius = 14;
+    int radius = 0;
+    if (!parseInt(getOptionValue(argc, argv, "--radius", "2"), 0, maxRadius, radius))
+    {
+        fprintf(stderr, "Invalid blur radius (expected 0 to %i)\n", maxRadius);
+        return 1;
+    }
+
     if (!initGL())
     {
         fprintf(stderr, "Failed to initialize GL!\n");
         return 1;
     }
 
-    GLTime computeTime;
+    ShaderDefines blurDefines = {{"BLUR_RADIUS", std::to_string(radius)}};
+
+    // Stream mode: process raw frames from stdin to stdout (stdout only carries frames)
+    if (hasOption(argc, argv, "--stream"))
+    {
+        GLuint streamHandle = createComputeShader("boxblur.comp", blurDefines);
+        int framesInFlight = atoi(getOptionValue(argc, argv, "--frames-in-flight", "3").c_str());
+        int result = runStream(streamHandle, 16, getOptionValue(argc, argv, "--size"), framesInFlight,
+                               getOptionValue(argc, argv, "--trace"));
+        closeGL();
+        return result;
+    }
+
     printGLInfo();
 
-    // Compile the compute shader and get its handle
-    GLuint computeHandle = createComputeShader("boxblur.comp");
+    // Compile the compute shader and get its handle.
+    // With --fused, the image is converted to grayscale and blurred in a single dispatch
+    bool fused = hasOption(argc, argv, "--fused");
+    GLuint computeHandle = createComputeShader(fused ? "boxblur_fused.comp" : "boxblur.comp", blurDefines);
 
     // Square image with power of two size
     int w;
     int h;
     int numChannels = 4;
 
-    // Load an image to a texture
+    // Load an image to a texture, decoded straight into the staging memory of the upload.
+    // With --gpu-decode, the CPU only entropy decodes the JPEG, the GPU does the rest
     std::string inputFilePath = getBinDirectory() + "landscape.jpg";
-    int inputNumChannels;
-    auto input = stbi_load(inputFilePath.c_str(), &w, &h, &inputNumChannels, numChannels); // Force image to load with 4 channels
-    if (!input) {
+    UploadRing uploads;
+    TexturePool textures;
+    GLuint inTex = 0;
+    if (hasOption(argc, argv, "--gpu-decode")) {
+        GpuJpegDecoder decoder;
+        GLTime decodeTime;
+        auto decodeStart = std::chrono::high_resolution_clock::now();
+        decodeTime.start();
+        inTex = decoder.load(inputFilePath, uploads, textures, w, h);
+        decodeTime.end();
+        double decodeWallMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - decodeStart).count();
+        if (inTex) {
+            printf("Image decoded on the GPU (GPU %f ms, CPU %f ms)\n", decodeTime.timeInMs(), decodeWallMs);
+        } else {
+            printf("'%s' cannot be decoded on the GPU, decoding on the CPU\n", inputFilePath.c_str());
+        }
+    }
+    if (!inTex) {
+        inTex = loadTexture(inputFilePath, uploads, textures, w, h); // Force image to load with 4 channels
+    }
+    if (!inTex) {
         fprintf(stderr, "Failed to load '%s'\n", inputFilePath.c_str());
         exit(39);
     }
     printf("Image loaded (width = %i, height = %i, number_channels = %i)\n", w, h, numChannels);
-    GLuint inTex = createTextureStorage(0, GL_READ_ONLY, w, h, input);
+    glState().bindImageTexture(0, inTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
 
     // Create the texture that will host the Black and white image
     GLuint outTex = createTextureStorage(1, GL_WRITE_ONLY, w, h); // Compute shader only write to RGBA format texture
 
-    // Execute the compute shader in 16x16-size workground
-    computeTime.start();
-    glUseProgram(computeHandle);
-    int localSize = 16;
-    glDispatchCompute((w + localSize - 1) / localSize , (h + localSize - 1) / localSize, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
-    computeTime.end();
+    // Execute the compute shader in 16x16-size workground (the timer is scoped to be deleted before closeGL())
+    float computeMs = 0.f;
+    {
+        GLTime computeTime;
+        computeTime.start();
+        glState().useProgram(computeHandle);
+        int localSize = 16;
+        glDispatchCompute((w + localSize - 1) / localSize , (h + localSize - 1) / localSize, 1);
+        glBarriers().imageWritten(outTex);
+        computeTime.end();
+        computeMs = computeTime.timeInMs();
+    }
     
-    // Buffer with 4 1-byte channels to store the texture data
-    auto img = readTextureStorage(outTex, numChannels, w, h);
-    const char* imgfile = "blur.png";
-    stbi_write_png(imgfile, w, h, numChannels /* bytes per pixel */, img.data(), w * numChannels);
-    printf("Image saved to '%s'\n", imgfile);
+    // Save the texture data (4 1-byte channels), the format is given by the file extension
+    std::string imgfile = getOptionValue(argc, argv, "--output", fused ? "blur_gray.png" : "blur.png");
+    int pngLevel = atoi(getOptionValue(argc, argv, "--png-level", "6").c_str());
+    // Optional region of interest: only these pixels are read back and saved
+    int rx = 0, ry = 0, rw = w, rh = h;
+    std::string region = getOptionValue(argc, argv, "--region");
+    if (!region.empty() &&
+        (sscanf(region.c_str(), "%i,%i,%i,%i", &rx, &ry, &rw, &rh) != 4 || rx < 0 || ry < 0 || rw <= 0 || rh <= 0 || rx + rw > w || ry + rh > h)) {
+        fprintf(stderr, "Invalid region '%s' (expected <x>,<y>,<width>,<height> inside the image)\n", region.c_str());
+        exit(43);
+    }
+    // With --gpu-png-filter, PNG rows are filtered on the GPU and the CPU only deflates them
+    bool saved;
+    if (hasOption(argc, argv, "--gpu-png-filter")) {
+        GpuPNGFilter pngFilter;
+        saved = pngFilter.saveTextureRegion(outTex, rx, ry, rw, rh, imgfile, pngLevel);
+    } else {
+        saved = saveTextureRegion(outTex, rx, ry, rw, rh, imgfile, pngLevel);
+    }
+    if (!saved) {
+        fprintf(stderr, "Failed to save '%s'\n", imgfile.c_str());
+        exit(42);
+    }
+    printf("Image saved to '%s'\n", imgfile.c_str());
     
     // Print timestamp
     printf("\n");
     printf("========== Time execution ================\n");
-    printf("Compute execution = %f ms\n", computeTime.timeInMs());
+    printf("Compute execution = %f ms\n", computeMs);
     printf("==========================================\n");
 
+    if (hasOption(argc, argv, "--bench"))
+    {
+        GLuint fusedHandle = fused ? computeHandle : createComputeShader("boxblur_fused.comp", blurDefines);
+        GLuint blurHandle = fused ? createComputeShader("boxblur.comp", blurDefines) : computeHandle;
+        benchmarkFusion(fusedHandle, blurHandle, inTex, w, h, radius, atoi(getOptionValue(argc, argv, "--iterations", "20").c_str()));
+    }
+
+    textures.clear();
+    uploads.destroy();
     closeGL();
 
     return 0;
@@ -0,0 +1,300 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Sequence of dispatches recorded once and replayed many times. Each step holds a program,
+// its image and SSBO bindings, uniforms and dispatch size; validate() checks them against
+// the context limits once, so that run() only walks flat arrays. Resources are either
+// fixed GL names or inputs set before each replay: bindings and uniforms go through
+// glState(), hence only the inputs that changed are rebound, and the barriers are
+// derived from the image accesses and written buffers through glBarriers().
+//
+//   ComputePipeline pipeline;
+//   ComputePipeline::Resource in = pipeline.input(), out = pipeline.input();
+//   pipeline.step(program)
+//       .image(0, in, GL_READ_ONLY, GL_RGBA8UI)
+//       .image(1, out, GL_WRITE_ONLY, GL_RGBA8UI)
+//       .dispatch((w + 15) / 16, (h + 15) / 16);
+//   pipeline.validate();
+//   ...
+//   pipeline.set(in, inTex);
+//   pipeline.set(out, outTex);
+//   pipeline.run();
+
+#include <stdio.h>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "gl_barriers.h"
+#include "gl_state.h"
+
+class ComputePipeline
+{
+public:
+    // A fixed GL name or an input of the pipeline
+    struct Resource
+    {
+        Resource(GLuint name = 0) : name(name) {}
+        GLuint name;
+        int input = -1;
+    };
+
+    class Step
+    {
+    public:
+        Step &image(GLuint unit, Resource texture, GLenum access, GLenum format)
+        {
+            images.push_back({unit, texture, access, format});
+            return *this;
+        }
+
+        // 'written' if the program writes the buffer (SSBO store, atomics)
+        Step &buffer(GLuint index, Resource buffer, bool written = false)
+        {
+            buffers.push_back({index, buffer, written});
+            return *this;
+        }
+
+        Step &uniform(GLint location, GLint x)
+        {
+            uniforms.push_back({location, 1, {x, 0}});
+            return *this;
+        }
+
+        Step &uniform(GLint location, GLint x, GLint y)
+        {
+            uniforms.push_back({location, 2, {x, y}});
+            return *this;
+        }
+
+        Step &dispatch(GLuint x, GLuint y = 1, GLuint z = 1)
+        {
+            groups[0] = x;
+            groups[1] = y;
+            groups[2] = z;
+            return *this;
+        }
+
+        // Groups read from 'buffer' at 'offset' when the step runs
+        Step &dispatchIndirect(Resource buffer, GLintptr offset = 0)
+        {
+            indirect = buffer;
+            indirectOffset = offset;
+            return *this;
+        }
+
+    private:
+        friend class ComputePipeline;
+
+        struct ImageBinding
+        {
+            GLuint unit;
+            Resource texture;
+            GLenum access;
+            GLenum format;
+        };
+
+        struct BufferBinding
+        {
+            GLuint index;
+            Resource buffer;
+            bool written;
+        };
+
+        struct Uniform
+        {
+            GLint location;
+            int size;
+            GLint values[2];
+        };
+
+        GLuint program = 0;
+        std::vector<ImageBinding> images;
+        std::vector<BufferBinding> buffers;
+        std::vector<Uniform> uniforms;
+        GLuint groups[3] = {0, 0, 0};
+        Resource indirect;
+        GLintptr indirectOffset = 0;
+    };
+
+    // New input, to be set before each run()
+    Resource input()
+    {
+        Resource resource;
+        resource.input = static_cast<int>(inputs.size());
+        inputs.push_back(0);
+        return resource;
+    }
+
+    void set(const Resource &input, GLuint name)
+    {
+        inputs[input.input] = name;
+    }
+
+    // Append a step running 'program' (the reference is valid until the next step())
+    Step &step(GLuint program)
+    {
+        steps.emplace_back();
+        steps.back().program = program;
+        validated = false;
+        return steps.back();
+    }
+
+    // Check the recorded steps against the context limits, errors are printed on stderr
+    bool validate()
+    {
+        GLint maxImageUnits = 0, maxBufferBindings = 0;
+        GLint maxGroups[3] = {0, 0, 0};
+        glGetIntegerv(GL_MAX_IMAGE_UNITS, &maxImageUnits);
+        glGetIntegerv(GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS, &maxBufferBindings);
+        for (GLuint i = 0; i < 3; ++i)
+        {
+            glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &maxGroups[i]);
+        }
+
+        bool valid = !steps.empty();
+        if (steps.empty())
+        {
+            fprintf(stderr, "ComputePipeline: no step recorded\n");
+        }
+        for (size_t i = 0; i < steps.size(); ++i)
+        {
+            const Step &step = steps[i];
+            GLint linked = GL_FALSE;
+            if (glIsProgram(step.program))
+            {
+                glGetProgramiv(step.program, GL_LINK_STATUS, &linked);
+            }
+            if (!linked)
+            {
+                fprintf(stderr, "ComputePipeline: step %zu has no linked program\n", i);
+                valid = false;
+            }
+            for (auto &image : step.images)
+            {
+                if (image.unit >= static_cast<GLuint>(maxImageUnits))
+                {
+                    fprintf(stderr, "ComputePipeline: step %zu binds image unit %u (max %i)\n", i, image.unit, maxImageUnits);
+                    valid = false;
+                }
+            }
+            for (auto &buffer : step.buffers)
+            {
+                if (buffer.index >= static_cast<GLuint>(maxBufferBindings))
+                {
+                    fprintf(stderr, "ComputePipeline: step %zu binds SSBO %u (max %i)\n", i, buffer.index, maxBufferBindings);
+                    valid = false;
+                }
+            }
+            if (isSet(step.indirect))
+            {
+                continue;
+            }
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (step.groups[axis] == 0 || step.groups[axis] > static_cast<GLuint>(maxGroups[axis]))
+                {
+                    fprintf(stderr, "ComputePipeline: step %zu dispatches %u groups on axis %i (max %i)\n",
+                            i, step.groups[axis], axis, maxGroups[axis]);
+                    valid = false;
+                }
+            }
+        }
+        validated = valid;
+        return valid;
+    }
+
+    // Replay every step. Fails if the pipeline is not validated or an input is not set.
+    bool run()
+    {
+        if (!validated)
+        {
+            fprintf(stderr, "ComputePipeline: run() before a successful validate()\n");
+            return false;
+        }
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            if (!inputs[i])
+            {
+                fprintf(stderr, "ComputePipeline: input %zu is not set\n", i);
+                return false;
+            }
+        }
+
+        GLStateCache &state = glState();
+        MemoryBarrierTracker &barriers = glBarriers();
+        for (const Step &step : steps)
+        {
+            state.useProgram(step.program);
+            for (const auto &image : step.images)
+            {
+                GLuint texture = resolve(image.texture);
+                barriers.textureAccess(texture, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+                state.bindImageTexture(image.unit, texture, 0, GL_FALSE, 0, image.access, image.format);
+            }
+            for (const auto &binding : step.buffers)
+            {
+                GLuint buffer = resolve(binding.buffer);
+                barriers.bufferAccess(buffer, GL_SHADER_STORAGE_BARRIER_BIT);
+                state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, binding.index, buffer);
+            }
+            for (const auto &uniform : step.uniforms)
+            {
+                // Cached per program, so pipelines sharing a program still set their own values
+                if (uniform.size == 1)
+                    state.programUniform1i(step.program, uniform.location, uniform.values[0]);
+                else
+                    state.programUniform2i(step.program, uniform.location, uniform.values[0], uniform.values[1]);
+            }
+            if (isSet(step.indirect))
+            {
+                GLuint buffer = resolve(step.indirect);
+                barriers.bufferAccess(buffer, GL_COMMAND_BARRIER_BIT);
+                state.bindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffer);
+                glDispatchComputeIndirect(step.indirectOffset);
+            }
+            else
+            {
+                glDispatchCompute(step.groups[0], step.groups[1], step.groups[2]);
+            }
+            for (const auto &image : step.images)
+            {
+                if (image.access != GL_READ_ONLY)
+                    barriers.imageWritten(resolve(image.texture));
+            }
+            for (const auto &binding : step.buffers)
+            {
+                if (binding.written)
+                    barriers.bufferWritten(resolve(binding.buffer));
+            }
+        }
+        return true;
+    }
+
+    size_t stepCount() const
+    {
+        return steps.size();
+    }
+
+private:
+    GLuint resolve(const Resource &resource) const
+    {
+        return resource.input >= 0 ? inputs[resource.input] : resource.name;
+    }
+
+    bool isSet(const Resource &resource) const
+    {
+        return resource.input >= 0 || resource.name != 0;
+    }
+
+    std::vector<Step> steps;
+    std::vector<GLuint> inputs;
+    bool validated = false;
+};
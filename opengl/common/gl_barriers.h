@@ -0,0 +1,131 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Minimal glMemoryBarrier() insertion. Image stores and SSBO writes are incoherent: the
+// next command using the resource needs a barrier whose bits match how it reads it
+// (GL_SHADER_IMAGE_ACCESS_BARRIER_BIT for an image load, GL_TEXTURE_UPDATE_BARRIER_BIT
+// for glGetTexImage, GL_BUFFER_UPDATE_BARRIER_BIT for glGetBufferSubData...).
+// The tracker records which resources were written by shaders and issues, at the point
+// of use, only the bits not already issued since that write:
+//
+//   glBarriers().textureAccess(inTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+//   glBarriers().textureAccess(outTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT); // Write after write
+//   glDispatchCompute(...);
+//   glBarriers().imageWritten(outTex);
+//   ...
+//   getTextureImage(outTex, ...); // Issues GL_TEXTURE_UPDATE_BARRIER_BIT (see gl_resources.h)
+//
+// Since a barrier covers every write issued before it, the order of the writes and of the
+// barriers is tracked with a single sequence number. There is one tracker per thread,
+// i.e. per context.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <GL/gl3w.h>
+
+class MemoryBarrierTracker
+{
+public:
+    // Shader writes of the dispatch just issued (image store, SSBO write, atomics)
+    void imageWritten(GLuint texture)
+    {
+        textureWrites[texture] = ++sequence;
+    }
+
+    void bufferWritten(GLuint buffer)
+    {
+        bufferWrites[buffer] = ++sequence;
+    }
+
+    // Call before a command accessing 'texture' the way described by 'barrierBits'
+    void textureAccess(GLuint texture, GLbitfield barrierBits)
+    {
+        access(textureWrites, texture, barrierBits);
+    }
+
+    void bufferAccess(GLuint buffer, GLbitfield barrierBits)
+    {
+        access(bufferWrites, buffer, barrierBits);
+    }
+
+    // Record a glMemoryBarrier() issued outside of the tracker
+    void issued(GLbitfield barrierBits)
+    {
+        ++sequence;
+        for (int bit = 0; bit < 32; ++bit)
+        {
+            if (barrierBits & (1u << bit))
+                bitSequence[bit] = sequence;
+        }
+    }
+
+    // Forget everything (new context...)
+    void invalidate()
+    {
+        textureWrites.clear();
+        bufferWrites.clear();
+    }
+
+    uint64_t barriers() const
+    {
+        return barrierCount;
+    }
+
+    uint64_t skipped() const
+    {
+        return skippedCount;
+    }
+
+    void print(FILE *out) const
+    {
+        fprintf(out, "Memory barriers   = %llu issued, %llu skipped\n",
+                static_cast<unsigned long long>(barrierCount), static_cast<unsigned long long>(skippedCount));
+    }
+
+private:
+    void access(const std::map<GLuint, uint64_t> &writes, GLuint name, GLbitfield barrierBits)
+    {
+        auto it = writes.find(name);
+        if (it == writes.end())
+        {
+            return; // Never written by a shader, nothing to make visible
+        }
+        GLbitfield missing = 0;
+        for (int bit = 0; bit < 32; ++bit)
+        {
+            if ((barrierBits & (1u << bit)) && bitSequence[bit] < it->second)
+                missing |= 1u << bit;
+        }
+        if (!missing)
+        {
+            ++skippedCount;
+            return;
+        }
+        glMemoryBarrier(missing);
+        ++barrierCount;
+        issued(missing);
+    }
+
+    uint64_t sequence = 0;
+    uint64_t bitSequence[32] = {};
+    std::map<GLuint, uint64_t> textureWrites;
+    std::map<GLuint, uint64_t> bufferWrites;
+    uint64_t barrierCount = 0;
+    uint64_t skippedCount = 0;
+};
+
+// Tracker of the context current on the calling thread
+MemoryBarrierTracker &glBarriers()
+{
+    static thread_local MemoryBarrierTracker tracker;
+    return tracker;
+}
@@ -0,0 +1,222 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Pool of worker threads, each one owning its own GL context, executing independent
+// jobs (one image, one buffer...) taken from a shared queue by whichever worker is free.
+// With software drivers (llvmpipe) or several GPUs, throughput then scales with the
+// number of contexts instead of serializing every job on the main context.
+//
+//   initGL();
+//   GLContextPool pool(4, false);
+//   auto result = pool.submit([](GLContextPool::Worker &worker) {
+//       glState().useProgram(worker.program("convert2gray.comp"));
+//       ...
+//   });
+//   result.get();
+//
+// When no worker could make its context current, pending and later jobs fail: their
+// future throws std::runtime_error.
+
+#include <stdio.h>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gl_helper.h"
+#include "upload.h"
+
+class GLContextPool
+{
+public:
+    // State of one worker, only accessed from its own thread
+    class Worker
+    {
+    public:
+        int index() const
+        {
+            return workerIndex;
+        }
+
+        // Program compiled in this worker's context on first use (the program
+        // binary cache makes it cheap for independent contexts)
+        GLuint program(const std::string &filename, const ShaderDefines &defines = ShaderDefines())
+        {
+            std::string key = filename + "\n" + definesToString(defines);
+            auto it = programs.find(key);
+            if (it != programs.end())
+            {
+                return it->second;
+            }
+            GLuint handle = createComputeShader(filename, defines);
+            programs[key] = handle;
+            return handle;
+        }
+
+        // Textures recycled between the jobs of this worker
+        TexturePool textures;
+
+        // Staging memory for the uploads of this worker
+        UploadRing &uploads()
+        {
+            if (!uploadRing)
+            {
+                uploadRing.reset(new UploadRing(64 << 20));
+            }
+            return *uploadRing;
+        }
+
+    private:
+        friend class GLContextPool;
+        int workerIndex = 0;
+        std::unique_ptr<UploadRing> uploadRing;
+        GLWorkerContext context;
+        std::map<std::string, GLuint> programs;
+    };
+
+    // Must be called by the thread owning the main context (after initGL()).
+    // 'shared' contexts share their objects with the main context.
+    GLContextPool(unsigned int workerCount, bool shared)
+    {
+        workerCount = workerCount > 0 ? workerCount : 1;
+        for (unsigned int i = 0; i < workerCount; ++i)
+        {
+            std::unique_ptr<Worker> worker(new Worker());
+            worker->workerIndex = static_cast<int>(i);
+            if (!createWorkerContext(shared, worker->context))
+            {
+                fprintf(stderr, "GLContextPool: failed to create context %u\n", i);
+                break;
+            }
+            workers.push_back(std::move(worker));
+        }
+        aliveWorkers = workers.size();
+        for (auto &worker : workers)
+        {
+            Worker *w = worker.get();
+            threads.emplace_back([this, w]() { workerLoop(*w); });
+        }
+    }
+
+    ~GLContextPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        for (auto &worker : workers)
+        {
+            destroyWorkerContext(worker->context);
+        }
+    }
+
+    GLContextPool(const GLContextPool &) = delete;
+    GLContextPool &operator=(const GLContextPool &) = delete;
+
+    // Queue 'job', called as job(Worker &) with the worker's context current
+    template <typename F>
+    auto submit(F &&job) -> std::future<decltype(job(std::declval<Worker &>()))>
+    {
+        using Result = decltype(job(std::declval<Worker &>()));
+        typename std::decay<F>::type task(std::forward<F>(job));
+        // Called without worker when none is left to run it
+        auto packaged = std::make_shared<std::packaged_task<Result(Worker *)>>([task](Worker *worker) mutable -> Result {
+            if (!worker)
+            {
+                throw std::runtime_error("GLContextPool: no GL context available");
+            }
+            return task(*worker);
+        });
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (aliveWorkers == 0)
+            {
+                (*packaged)(nullptr);
+                return result;
+            }
+            jobs.push([packaged](Worker *worker) { (*packaged)(worker); });
+        }
+        condition.notify_one();
+        return result;
+    }
+
+    // Number of contexts actually created
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+private:
+    void workerLoop(Worker &worker)
+    {
+        if (!makeWorkerContextCurrent(&worker.context))
+        {
+            fprintf(stderr, "GLContextPool: failed to make context %i current\n", worker.workerIndex);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--aliveWorkers == 0)
+            {
+                // Nobody left to run the pending jobs
+                while (!jobs.empty())
+                {
+                    jobs.front()(nullptr);
+                    jobs.pop();
+                }
+            }
+            return;
+        }
+        enableGLDebugOutput();
+        for (;;)
+        {
+            std::function<void(Worker *)> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                {
+                    break;
+                }
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job(&worker);
+        }
+        for (auto &program : worker.programs)
+        {
+            glState().deleteProgram(program.second);
+        }
+        worker.textures.clear();
+        worker.uploadRing.reset();
+        glFinish();
+        makeWorkerContextCurrent(nullptr);
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::queue<std::function<void(Worker *)>> jobs;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+    size_t aliveWorkers = 0; // Workers whose context could be made current (or not tried yet)
+};
@@ -0,0 +1,283 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// GL error reporting through KHR_debug (core since 4.3) instead of glGetError polling.
+// The driver calls glDebugCallback() (asynchronously by default), which prints the
+// message and updates the per-severity counters of its context: GLErrorCheck() then only
+// compares counters and never round-trips to the driver. Configured with the CS_GL_DEBUG environment variable:
+//  - unset:   errors and warnings (high and medium severities) are reported
+//  - verbose: every message, notifications included
+//  - strict:  synchronous output, GLErrorCheck() throws a GLError with its call site
+//             when a high severity message was reported since the previous check
+//  - off:     debug output disabled, GLErrorCheck() falls back to glGetError()
+// GLErrorCheck() also falls back to glGetError() when KHR_debug is not available.
+// CS_GL_DEBUG_IGNORE="id,id,..." additionally mutes the given message ids.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <GL/gl3w.h>
+
+// Messages of one context, updated by the driver callback (through its user parameter)
+struct GLDebugCounters
+{
+    std::atomic<unsigned int> high{0};
+    std::atomic<unsigned int> medium{0};
+    std::atomic<unsigned int> low{0};
+    std::atomic<unsigned int> notification{0};
+    std::atomic<unsigned int> reported{0}; // High severity messages already reported by GLErrorCheck()
+};
+
+// Thrown by GLErrorCheck() in strict mode
+class GLError : public std::runtime_error
+{
+public:
+    explicit GLError(const std::string &what) : std::runtime_error(what) {}
+};
+
+// Counters of the context current on the calling thread (one context per thread, as
+// glState()). They are never freed: the driver may call back while a context is destroyed.
+GLDebugCounters &glDebugCounters()
+{
+    static std::mutex mutex;
+    static std::deque<GLDebugCounters> allCounters;
+    static thread_local GLDebugCounters *counters = nullptr;
+    if (!counters)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        allCounters.emplace_back();
+        counters = &allCounters.back();
+    }
+    return *counters;
+}
+
+// Contexts are created as debug contexts unless CS_GL_DEBUG=off: on other contexts, drivers
+// may report few messages or none
+bool glDebugContextRequested()
+{
+    const char *mode = getenv("CS_GL_DEBUG");
+    return !mode || std::string(mode) != "off";
+}
+
+// Set by enableGLDebugOutput() and read by the pool threads and the driver callback
+static std::atomic<bool> &glDebugEnabled()
+{
+    static std::atomic<bool> enabled{false};
+    return enabled;
+}
+
+static std::atomic<bool> &glDebugStrict()
+{
+    static std::atomic<bool> strict{false};
+    return strict;
+}
+
+// KHR_debug on the current context: core since 4.3, extension before
+static bool glDebugSupported()
+{
+    if (gl3wIsSupported(4, 3))
+    {
+        return true;
+    }
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (name && strcmp(name, "GL_KHR_debug") == 0)
+        {
+            return glDebugMessageCallback != nullptr;
+        }
+    }
+    return false;
+}
+
+// Last high severity message of the calling thread, consumed by GLErrorCheck() in strict mode
+static std::string &glDebugPendingError()
+{
+    static thread_local std::string pending;
+    return pending;
+}
+
+static const char *glDebugSeverityName(GLenum severity)
+{
+    switch (severity)
+    {
+    case GL_DEBUG_SEVERITY_HIGH:
+        return "high";
+    case GL_DEBUG_SEVERITY_MEDIUM:
+        return "medium";
+    case GL_DEBUG_SEVERITY_LOW:
+        return "low";
+    default:
+        return "notification";
+    }
+}
+
+static const char *glDebugTypeName(GLenum type)
+{
+    switch (type)
+    {
+    case GL_DEBUG_TYPE_ERROR:
+        return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+        return "deprecated";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+        return "undefined behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:
+        return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:
+        return "performance";
+    default:
+        return "other";
+    }
+}
+
+void APIENTRY glDebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+                              const GLchar *message, const void *userParam)
+{
+    (void)source;
+    (void)length;
+    // Asynchronous output may call back on a driver thread: the context is given by 'userParam'
+    GLDebugCounters &counters = *static_cast<GLDebugCounters *>(const_cast<void *>(userParam));
+    switch (severity)
+    {
+    case GL_DEBUG_SEVERITY_HIGH:
+        ++counters.high;
+        if (glDebugStrict())
+        {
+            // Synchronous output: this is the thread that issued the failing call
+            glDebugPendingError() = message;
+        }
+        break;
+    case GL_DEBUG_SEVERITY_MEDIUM:
+        ++counters.medium;
+        break;
+    case GL_DEBUG_SEVERITY_LOW:
+        ++counters.low;
+        break;
+    default:
+        ++counters.notification;
+        break;
+    }
+    fprintf(stderr, "GL %s (%s, id %u): %s\n", glDebugTypeName(type), glDebugSeverityName(severity), id, message);
+}
+
+// Enable the debug output on the current context according to CS_GL_DEBUG.
+// Must be called for every context (see initGL() and GLContextPool).
+bool enableGLDebugOutput()
+{
+    const char *mode = getenv("CS_GL_DEBUG");
+    std::string debugMode = mode ? mode : "";
+    if (debugMode == "off")
+    {
+        return false;
+    }
+    if (!glDebugSupported())
+    {
+        fprintf(stderr, "KHR_debug not supported, GL errors are polled with glGetError()\n");
+        return false;
+    }
+    bool strict = debugMode == "strict";
+    glDebugStrict() = strict;
+    glDebugEnabled() = true;
+    glEnable(GL_DEBUG_OUTPUT);
+    if (strict)
+    {
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    }
+    glDebugMessageCallback(glDebugCallback, &glDebugCounters());
+    if (debugMode != "verbose")
+    {
+        // Filtered by the driver, so that ignored messages are not even formatted
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_LOW, 0, nullptr, GL_FALSE);
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+    }
+    const char *ignore = getenv("CS_GL_DEBUG_IGNORE");
+    std::vector<GLuint> ignoredIds;
+    for (const char *p = ignore; p && *p;)
+    {
+        char *end = nullptr;
+        unsigned long id = strtoul(p, &end, 0);
+        if (end == p)
+        {
+            break;
+        }
+        ignoredIds.push_back(static_cast<GLuint>(id));
+        p = *end == ',' ? end + 1 : end;
+    }
+    if (!ignoredIds.empty())
+    {
+        // Ids are only unique per (source, type), which must be explicit when passing ids
+        const GLenum sources[] = {GL_DEBUG_SOURCE_API, GL_DEBUG_SOURCE_WINDOW_SYSTEM, GL_DEBUG_SOURCE_SHADER_COMPILER,
+                                  GL_DEBUG_SOURCE_THIRD_PARTY, GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_SOURCE_OTHER};
+        const GLenum types[] = {GL_DEBUG_TYPE_ERROR, GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR, GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR,
+                                GL_DEBUG_TYPE_PORTABILITY, GL_DEBUG_TYPE_PERFORMANCE, GL_DEBUG_TYPE_MARKER,
+                                GL_DEBUG_TYPE_PUSH_GROUP, GL_DEBUG_TYPE_POP_GROUP, GL_DEBUG_TYPE_OTHER};
+        for (GLenum source : sources)
+        {
+            for (GLenum type : types)
+            {
+                glDebugMessageControl(source, type, GL_DONT_CARE, static_cast<GLsizei>(ignoredIds.size()), ignoredIds.data(), GL_FALSE);
+            }
+        }
+    }
+    return true;
+}
+
+void printGLDebugCounters(FILE *out)
+{
+    GLDebugCounters &counters = glDebugCounters();
+    fprintf(out, "GL debug messages: %u high, %u medium, %u low, %u notification\n",
+            counters.high.load(), counters.medium.load(), counters.low.load(), counters.notification.load());
+}
+
+// Report the errors signaled since the previous check, along with 'message' and the call site.
+// Only reads a counter (and a thread local string in strict mode): no driver round-trip.
+void checkGLErrors(const char *message, const char *file, int line)
+{
+    if (!glDebugEnabled())
+    {
+        GLenum error = glGetError();
+        if (error != GL_NO_ERROR)
+        {
+            fprintf(stderr, "GL error 0x%04x: %s (%s:%i)\n", error, message, file, line);
+        }
+        return;
+    }
+    if (glDebugStrict())
+    {
+        std::string &pending = glDebugPendingError();
+        if (!pending.empty())
+        {
+            std::string what = std::string(message) + " (" + file + ":" + std::to_string(line) + "): " + pending;
+            pending.clear();
+            throw GLError(what);
+        }
+        return;
+    }
+    GLDebugCounters &counters = glDebugCounters();
+    unsigned int errors = counters.high.load(std::memory_order_relaxed);
+    unsigned int previous = counters.reported.exchange(errors, std::memory_order_relaxed);
+    if (errors != previous)
+    {
+        fprintf(stderr, "%u GL error(s) reported before: %s (%s:%i)\n", errors - previous, message, file, line);
+    }
+}
+
+// Kept as a macro to capture the call site
+#define GLErrorCheck(message) checkGLErrors(message, __FILE__, __LINE__)
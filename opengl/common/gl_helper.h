@@ -9,7 +9,19 @@
 
 #pragma once
 
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <stdlib.h>
 #include <GL/gl3w.h>
+// The samples can create their context with a hidden GLFW window (needs a display)
+// and/or with headless EGL (render nodes, CI). CMake defines which ones are available.
+#ifdef CS_HAVE_GLFW
 #include <GLFW/glfw3.h>
 #ifdef __linux__
 #define GLFW_EXPOSE_NATIVE_X11
@@ -17,42 +29,17 @@
 #elif _WIN32
 #define GLFW_EXPOSE_NATIVE_WIN3
 #endif
-
-
-#ifndef NDEBUG
-// If there is a glError this outputs it along with a message to stderr.
-// otherwise there is no output.
-void GLErrorCheck(const char *message)
-{
-    GLenum val = glGetError();
-    switch (val)
-    {
-    case GL_INVALID_ENUM:
-        fprintf(stderr, "GL_INVALID_ENUM : %s\n", message);
-        break;
-    case GL_INVALID_VALUE:
-        fprintf(stderr, "GL_INVALID_VALUE : %s\n", message);
-        break;
-    case GL_INVALID_OPERATION:
-        fprintf(stderr, "GL_INVALID_OPERATION : %s\n", message);
-        break;
-#ifndef GL_ES_VERSION_2_0
-    case GL_STACK_OVERFLOW:
-        fprintf(stderr, "GL_STACK_OVERFLOW : %s\n", message);
-        break;
-    case GL_STACK_UNDERFLOW:
-        fprintf(stderr, "GL_STACK_UNDERFLOW : %s\n", message);
-        break;
 #endif
-    case GL_OUT_OF_MEMORY:
-        fprintf(stderr, "GL_OUT_OF_MEMORY : %s\n", message);
-        break;
-    case GL_NO_ERROR:
-        break;
-    }
-}
+#ifdef CS_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #endif
 
+#include "shader_preprocessor.h"
+#include "gl_debug.h"
+#include "gl_state.h"
+#include "gl_resources.h"
+
 void printGLInfo() {
     printf("============  GL Info  ===============\n");
     printf("OpenGL version          = %s\n", glGetString(GL_VENDOR));
@@ -72,24 +59,153 @@ void printGLInfo() {
     printf("Max number of workgroups   = %i, %i, %i\n", maxWGCount[0], maxWGCount[1], maxWGCount[2]);
     printf("Max size of a workgroup    = %i, %i, %i\n", maxWGSize[0], maxWGSize[1], maxWGSize[2]);
     printf("Max number of invokations in a workgroup = %i\n", maxWGInvokations);
+    printf("Direct state access        = %s\n", glUseDSA() ? "yes" : "no");
     printf("======================================\n");
     printf("\n");
 }
 
-GLuint createComputeShader(const std::string& filename)
+// Key of a linked program in the program binary cache: binaries are only valid
+// for the same source, defines, driver and GPU
+uint64_t getProgramCacheKey(const std::string &source, const std::string &defines)
+{
+    const char *renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+    const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+    uint64_t hash = hashFNV1a(source.data(), source.size());
+    hash = hashFNV1a(defines.data(), defines.size(), hash);
+    hash = hashFNV1a(renderer, renderer ? strlen(renderer) : 0, hash);
+    return hashFNV1a(version, version ? strlen(version) : 0, hash);
+}
+
+// Program binary cache file path, empty if the cache is disabled (CS_CACHE_DIR="")
+// or if the driver does not support any program binary format
+std::string getProgramCachePath(uint64_t key)
+{
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    std::string cacheDir = getCacheDirectory();
+    if (numFormats <= 0 || cacheDir.empty())
+    {
+        return "";
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return cacheDir + "programs/" + name;
+}
+
+// Cache file layout: "CSPB" magic, binary format, binary length, binary
+bool loadProgramBinary(GLuint program, const std::string &path)
+{
+    FILE *f = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+    if (!f)
+    {
+        return false;
+    }
+    char magic[4];
+    uint32_t header[2];
+    std::vector<char> binary;
+    bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, "CSPB", 4) == 0 &&
+              fread(header, sizeof(uint32_t), 2, f) == 2;
+    if (ok)
+    {
+        // A truncated or corrupted file must not size the read: the length has to match the
+        // bytes left in the file
+        long start = ftell(f);
+        ok = start >= 0 && fseek(f, 0, SEEK_END) == 0;
+        long end = ok ? ftell(f) : -1;
+        ok = ok && end >= start && header[1] > 0 && static_cast<uint64_t>(end - start) == header[1] &&
+             fseek(f, start, SEEK_SET) == 0;
+    }
+    if (ok)
+    {
+        binary.resize(header[1]);
+        ok = fread(binary.data(), 1, binary.size(), f) == binary.size();
+    }
+    fclose(f);
+    if (ok)
+    {
+        // The format must be one the driver supports
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        std::vector<GLint> formats(std::max(numFormats, 0));
+        if (!formats.empty())
+        {
+            glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+        }
+        ok = std::find(formats.begin(), formats.end(), static_cast<GLint>(header[0])) != formats.end();
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Ignoring invalid program binary '%s'\n", path.c_str());
+        return false;
+    }
+    // The driver rejects binaries built by another driver version
+    glProgramBinary(program, header[0], binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+    {
+        glGetError(); // An unknown binary format is reported as GL_INVALID_ENUM, the program is compiled instead
+    }
+    return linked == GL_TRUE;
+}
+
+void saveProgramBinary(GLuint program, const std::string &path)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (path.empty() || length <= 0 || !createDirectories(parentDirectory(path)))
+    {
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    // Write to a temporary file first so that concurrent processes (or the contexts of
+    // a GLContextPool) never read a partial binary
+    std::string threadId = std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#ifdef _WIN32
+    std::string tmpPath = path + "." + std::to_string(GetCurrentProcessId()) + "." + threadId + ".tmp";
+#else
+    std::string tmpPath = path + "." + std::to_string(getpid()) + "." + threadId + ".tmp";
+#endif
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+    {
+        return;
+    }
+    uint32_t header[2] = {format, static_cast<uint32_t>(length)};
+    bool ok = fwrite("CSPB", 1, 4, f) == 4 && fwrite(header, sizeof(uint32_t), 2, f) == 2 &&
+              fwrite(binary.data(), 1, length, f) == static_cast<size_t>(length);
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tmpPath.c_str());
+    }
+}
+
+// Compile and link the compute shader 'filename' (see shader_preprocessor.h for
+// #include support and the injection of 'defines')
+GLuint createComputeShader(const std::string& filename, const ShaderDefines& defines = ShaderDefines())
 {
     // Creating the compute shader, and the program object containing the shader
     GLuint progHandle = glCreateProgram();
-    GLuint cs = glCreateShader(GL_COMPUTE_SHADER);
 
-    std::string csSrc;
-    std::string shaderFilePath = getShaderDirectory() + filename;
-    if (!loadFile(shaderFilePath, csSrc))
+    PreprocessedShader shader = preprocessShader(filename, defines);
+    if (!shader.error.empty())
     {
-        fprintf(stderr, "Error in loading the compute shader %s\n", shaderFilePath.c_str());
+        fprintf(stderr, "Error in loading the compute shader %s: %s\n", filename.c_str(), shader.error.c_str());
         exit(39);
     }
+    const std::string& csSrc = shader.source;
+
+    // Skip compilation and linking when the program binary is in the cache
+    std::string cachePath = getProgramCachePath(getProgramCacheKey(csSrc, definesToString(defines)));
+    if (loadProgramBinary(progHandle, cachePath))
+    {
+        return progHandle;
+    }
 
+    GLuint cs = glCreateShader(GL_COMPUTE_SHADER);
     const GLchar *sourcePtr = csSrc.c_str();
     int size = static_cast<int>(csSrc.size());
     glShaderSource(cs, 1, (const GLchar **)&sourcePtr, &size);
@@ -98,15 +214,20 @@ GLuint createComputeShader(const std::string& filename)
     glGetShaderiv(cs, GL_COMPILE_STATUS, &rvalue);
     if (!rvalue)
     {
-        fprintf(stderr, "Error in compiling the compute shader\n");
+        fprintf(stderr, "Error in compiling the compute shader %s\n", filename.c_str());
         GLchar log[10240];
         GLsizei length;
         glGetShaderInfoLog(cs, 10239, &length, log);
         fprintf(stderr, "Compiler log:\n%s\n", log);
+        for (size_t i = 0; i < shader.files.size(); ++i)
+        {
+            fprintf(stderr, "Source string %zu = %s\n", i, shader.files[i].c_str());
+        }
         exit(40);
     }
     glAttachShader(progHandle, cs);
 
+    glProgramParameteri(progHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(progHandle);
     glGetProgramiv(progHandle, GL_LINK_STATUS, &rvalue);
     if (!rvalue)
@@ -118,38 +239,57 @@ GLuint createComputeShader(const std::string& filename)
         fprintf(stderr, "Linker log:\n%s\n", log);
         exit(41);
     }
+    glDetachShader(progHandle, cs);
+    glDeleteShader(cs);
+
+    saveProgramBinary(progHandle, cachePath);
 
     GLErrorCheck("Compute shader");
     return progHandle;
 }
 
+// Build every variant of one shader source, programs are indexed by variant name
+std::map<std::string, GLuint> createComputeShaderVariants(const std::string& filename, const std::vector<ShaderVariant>& variants)
+{
+    std::map<std::string, GLuint> programs;
+    for (auto& variant : variants)
+    {
+        programs[variant.name] = createComputeShader(filename, variant.defines);
+    }
+    return programs;
+}
+
 std::vector<uint8_t> readTextureStorage(GLuint tex, int numChannels, int width, int height) {
     std::vector<uint8_t> img(width * height * numChannels);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, img.data());
+    getTextureImage(tex, GL_RGBA_INTEGER, img.size(), img.data());
     return img;
 }
 
 
 GLuint createTextureStorage(GLuint unit, GLenum access, int width, int height, unsigned char* data = nullptr) {
-    GLuint tex;
     GLenum internalFormat = GL_RGBA8UI; // Each pixel will be stored in 4 unsigned integer [0,255]
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+    GLuint tex = createTexture2D(internalFormat, width, height);
     if (data) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0 /* mipmap level */, 0,0, width, height, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, data);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        updateTexture2D(tex, width, height, GL_RGBA_INTEGER, data);
     }
-    glActiveTexture(GL_TEXTURE0);
-    glBindImageTexture(unit, tex, 0, GL_FALSE, 0, access, internalFormat);
+    glState().activeTexture(GL_TEXTURE0);
+    glState().bindImageTexture(unit, tex, 0, GL_FALSE, 0, access, internalFormat);
     return tex;
 }
 
+#ifdef CS_HAVE_GLFW
 GLFWwindow *offscreen_context = nullptr;
+#endif
+#ifdef CS_HAVE_EGL
+EGLDisplay egl_display = EGL_NO_DISPLAY;
+EGLContext egl_context = EGL_NO_CONTEXT;
+EGLConfig egl_config = nullptr;
+#endif
 
-// Create an OpenGL context
-bool initGL()
+void closeGL();
+
+#ifdef CS_HAVE_GLFW
+static bool initGLFW()
 {
     if (!glfwInit())
     {
@@ -159,25 +299,303 @@ bool initGL()
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, glDebugContextRequested() ? GLFW_TRUE : GLFW_FALSE);
     offscreen_context = glfwCreateWindow(250, 250, "test", NULL, NULL);
     if (!offscreen_context)
     {
+        glfwTerminate();
         return false;
     }
     glfwMakeContextCurrent(offscreen_context);
     glfwSwapInterval(0);
 
     if (gl3wInit())
+    {
+        closeGL();
+        return false;
+    }
+    return true;
+}
+#endif
+
+#ifdef CS_HAVE_EGL
+static bool hasEGLExtension(const char *extensions, const char *name)
+{
+    size_t length = strlen(name);
+    for (const char *p = extensions ? strstr(extensions, name) : nullptr; p; p = strstr(p + length, name))
+    {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Debug context unless CS_GL_DEBUG=off, falling back to a regular one if the driver refuses it
+static EGLContext createEGLCoreContext(EGLDisplay display, EGLConfig config, EGLContext share)
+{
+    EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION, 4,
+                               EGL_CONTEXT_MINOR_VERSION, 3,
+                               EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                               EGL_CONTEXT_OPENGL_DEBUG, glDebugContextRequested() ? EGL_TRUE : EGL_FALSE,
+                               EGL_NONE};
+    EGLContext context = eglCreateContext(display, config, share, contextAttribs);
+    if (context == EGL_NO_CONTEXT && contextAttribs[7] == EGL_TRUE)
+    {
+        contextAttribs[7] = EGL_FALSE;
+        context = eglCreateContext(display, config, share, contextAttribs);
+    }
+    return context;
+}
+
+// Create a core 4.3 context on 'display' without any surface (EGL_KHR_surfaceless_context)
+static bool createEGLContext(EGLDisplay display)
+{
+    EGLint major, minor;
+    if (!eglInitialize(display, &major, &minor))
+    {
+        return false;
+    }
+    if (!hasEGLExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context") ||
+        !eglBindAPI(EGL_OPENGL_API))
+    {
+        eglTerminate(display);
+        return false;
+    }
+    // No surface is ever created: any config will do, even one without pbuffer support
+    const EGLint configAttribs[] = {EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config = nullptr;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+    {
+        eglTerminate(display);
+        return false;
+    }
+    EGLContext context = createEGLCoreContext(display, config, EGL_NO_CONTEXT);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+    egl_display = display;
+    egl_context = context;
+    egl_config = config;
+    return true;
+}
+
+static bool initEGL()
+{
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (!getPlatformDisplay)
+    {
+        return false;
+    }
+
+    // Mesa surfaceless platform first (render nodes, llvmpipe), then every EGL device (e.g. NVIDIA)
+    bool ok = false;
+    if (hasEGLExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+    {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        ok = display != EGL_NO_DISPLAY && createEGLContext(display);
+    }
+    auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+    if (!ok && queryDevices && hasEGLExtension(clientExtensions, "EGL_EXT_platform_device"))
+    {
+        EGLDeviceEXT devices[16];
+        EGLint numDevices = 0;
+        queryDevices(16, devices, &numDevices);
+        for (EGLint i = 0; i < numDevices && !ok; ++i)
+        {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i], nullptr);
+            ok = display != EGL_NO_DISPLAY && createEGLContext(display);
+        }
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    // Core functions are resolved through EGL since no GLX/WGL context is current
+    if (gl3wInit2(reinterpret_cast<GL3WGetProcAddressProc>(eglGetProcAddress)))
+    {
+        closeGL();
+        return false;
+    }
+    return true;
+}
+#endif
+
+static bool createMainContext()
+{
+    const char *backend = getenv("CS_GL_BACKEND");
+    std::string forced = backend ? backend : "";
+#ifdef __linux__
+    bool hasDisplay = getenv("DISPLAY") || getenv("WAYLAND_DISPLAY");
+#else
+    bool hasDisplay = true;
+#endif
+#ifdef CS_HAVE_EGL
+    if (forced == "egl" || (forced.empty() && !hasDisplay))
+    {
+        if (initEGL())
+        {
+            return true;
+        }
+        if (!forced.empty())
+        {
+            return false;
+        }
+    }
+#endif
+#ifdef CS_HAVE_GLFW
+    if (forced.empty() || forced == "glfw")
+    {
+        if (initGLFW())
+        {
+            return true;
+        }
+    }
+#endif
+#ifdef CS_HAVE_EGL
+    // No usable window system (e.g. DISPLAY set but unreachable): last chance headless
+    if (forced.empty() && hasDisplay)
+    {
+        return initEGL();
+    }
+#endif
+    (void)hasDisplay;
+    return false;
+}
+
+// Create an OpenGL context. Headless EGL is used when there is no display
+// (or when CS_GL_BACKEND=egl), a hidden GLFW window otherwise (CS_GL_BACKEND=glfw).
+// Errors are reported through the debug output (see gl_debug.h).
+bool initGL()
+{
+    if (!createMainContext())
     {
         return false;
     }
+    enableGLDebugOutput();
     return true;
 }
 
 void closeGL()
 {
-    glfwDestroyWindow(offscreen_context);
-    glfwTerminate();
+    glState().invalidate();
+    glBarriers().invalidate();
+    GLDebugCounters &counters = glDebugCounters();
+    if (counters.high > 0 || counters.medium > 0)
+    {
+        printGLDebugCounters(stderr);
+    }
+#ifdef CS_HAVE_EGL
+    if (egl_display != EGL_NO_DISPLAY)
+    {
+        eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (egl_context != EGL_NO_CONTEXT)
+            eglDestroyContext(egl_display, egl_context);
+        eglTerminate(egl_display);
+        egl_display = EGL_NO_DISPLAY;
+        egl_context = EGL_NO_CONTEXT;
+        egl_config = nullptr;
+    }
+#endif
+#ifdef CS_HAVE_GLFW
+    if (offscreen_context)
+    {
+        glfwDestroyWindow(offscreen_context);
+        glfwTerminate();
+        offscreen_context = nullptr;
+    }
+#endif
+}
+
+// Additional context created by the thread owning the main context (see initGL()),
+// then made current on a worker thread
+struct GLWorkerContext
+{
+#ifdef CS_HAVE_GLFW
+    GLFWwindow *window = nullptr;
+#endif
+#ifdef CS_HAVE_EGL
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// Create a context with the same backend as the main context. When 'shared', objects
+// (programs, textures, buffers) are shared with the main context, otherwise the context
+// is independent and avoids the driver locks of shared object namespaces.
+bool createWorkerContext(bool shared, GLWorkerContext &worker)
+{
+#ifdef CS_HAVE_EGL
+    if (egl_display != EGL_NO_DISPLAY)
+    {
+        worker.context = createEGLCoreContext(egl_display, egl_config, shared ? egl_context : EGL_NO_CONTEXT);
+        return worker.context != EGL_NO_CONTEXT;
+    }
+#endif
+#ifdef CS_HAVE_GLFW
+    if (offscreen_context)
+    {
+        // Window hints set by initGLFW() still apply
+        worker.window = glfwCreateWindow(1, 1, "worker", NULL, shared ? offscreen_context : NULL);
+        if (worker.window)
+        {
+            // glfwCreateWindow() may have changed the current context
+            glfwMakeContextCurrent(offscreen_context);
+        }
+        return worker.window != nullptr;
+    }
+#endif
+    (void)shared;
+    (void)worker;
+    return false;
+}
+
+// Make 'worker' current on the calling thread, or release the current context if nullptr
+bool makeWorkerContextCurrent(const GLWorkerContext *worker)
+{
+#ifdef CS_HAVE_EGL
+    if (egl_display != EGL_NO_DISPLAY)
+    {
+        return eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, worker ? worker->context : EGL_NO_CONTEXT) == EGL_TRUE;
+    }
+#endif
+#ifdef CS_HAVE_GLFW
+    if (offscreen_context)
+    {
+        glfwMakeContextCurrent(worker ? worker->window : NULL);
+        return true;
+    }
+#endif
+    (void)worker;
+    return false;
+}
+
+// Must be called by the thread owning the main context, once the worker released it
+void destroyWorkerContext(GLWorkerContext &worker)
+{
+#ifdef CS_HAVE_EGL
+    if (egl_display != EGL_NO_DISPLAY && worker.context != EGL_NO_CONTEXT)
+    {
+        eglDestroyContext(egl_display, worker.context);
+        worker.context = EGL_NO_CONTEXT;
+    }
+#endif
+#ifdef CS_HAVE_GLFW
+    if (worker.window)
+    {
+        glfwDestroyWindow(worker.window);
+        glfwMakeContextCurrent(offscreen_context);
+        worker.window = nullptr;
+    }
+#endif
+    (void)worker;
 }
 
 class GLTime
@@ -187,6 +605,14 @@ public:
         glGenQueries(1, query);
     }
 
+    // Must be destroyed before closeGL()
+    ~GLTime() {
+        glDeleteQueries(1, query);
+    }
+
+    GLTime(const GLTime &) = delete;
+    GLTime &operator=(const GLTime &) = delete;
+
     void start() {
         glBeginQuery(GL_TIME_ELAPSED, query[0]);
     }
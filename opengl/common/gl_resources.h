@@ -0,0 +1,209 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Texture and buffer creation/access with Direct State Access (GL 4.5): objects are
+// edited by name (glCreateTextures, glTextureStorage2D, glNamedBufferStorage...) instead
+// of being bound first. The bind-to-edit path of GL 4.3 is kept as fallback, and can be
+// forced with CS_GL_DSA=off. Accesses go through glBarriers() so that shader writes are
+// made visible (see gl_barriers.h).
+//
+// glGetTextureSubImage also reads back a region of interest of a texture instead of the
+// whole level; the fallback reads it with glReadPixels through a framebuffer.
+
+#include <stdlib.h>
+#include <string>
+#include <GL/gl3w.h>
+
+#include "gl_barriers.h"
+#include "gl_state.h"
+
+// True when the DSA entry points are used (needs a current context on first call)
+bool glUseDSA()
+{
+    static const bool useDSA = []() {
+        const char *env = getenv("CS_GL_DSA");
+        std::string mode = env ? env : "";
+        if (mode == "off" || mode == "0")
+        {
+            return false;
+        }
+        return gl3wIsSupported(4, 5) != 0;
+    }();
+    return useDSA;
+}
+
+// Immutable single level texture
+GLuint createTexture2D(GLenum internalFormat, int width, int height)
+{
+    GLuint tex;
+    if (glUseDSA())
+    {
+        glCreateTextures(GL_TEXTURE_2D, 1, &tex);
+        glTextureStorage2D(tex, 1, internalFormat, width, height);
+        glTextureParameteri(tex, GL_TEXTURE_MAX_LEVEL, 0);
+        return tex;
+    }
+    glGenTextures(1, &tex);
+    glState().bindTexture(GL_TEXTURE_2D, tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    return tex;
+}
+
+// Write the whole level 0 of 'tex' ('pixels' is an offset when an unpack buffer is bound)
+void updateTexture2D(GLuint tex, int width, int height, GLenum format, const void *pixels)
+{
+    glBarriers().textureAccess(tex, GL_TEXTURE_UPDATE_BARRIER_BIT);
+    if (glUseDSA())
+    {
+        glTextureSubImage2D(tex, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, pixels);
+        return;
+    }
+    glState().bindTexture(GL_TEXTURE_2D, tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, pixels);
+}
+
+// Read the whole level 0 of 'tex' ('pixels' is an offset when a pack buffer is bound)
+void getTextureImage(GLuint tex, GLenum format, size_t bufSize, void *pixels)
+{
+    glBarriers().textureAccess(tex, GL_TEXTURE_UPDATE_BARRIER_BIT);
+    if (glUseDSA())
+    {
+        glGetTextureImage(tex, 0, format, GL_UNSIGNED_BYTE, static_cast<GLsizei>(bufSize), pixels);
+        return;
+    }
+    glState().bindTexture(GL_TEXTURE_2D, tex);
+    glGetTexImage(GL_TEXTURE_2D, 0, format, GL_UNSIGNED_BYTE, pixels);
+}
+
+// Read the w x h region of level 0 of 'tex' starting at (x, y) ('pixels' is an offset when a pack buffer is bound)
+void getTextureRegion(GLuint tex, int x, int y, int w, int h, GLenum format, size_t bufSize, void *pixels)
+{
+    if (glUseDSA())
+    {
+        glBarriers().textureAccess(tex, GL_TEXTURE_UPDATE_BARRIER_BIT);
+        glGetTextureSubImage(tex, 0, x, y, 0, w, h, 1, format, GL_UNSIGNED_BYTE, static_cast<GLsizei>(bufSize), pixels);
+        return;
+    }
+    if (x == 0 && y == 0)
+    {
+        GLint levelWidth = 0, levelHeight = 0;
+        glState().bindTexture(GL_TEXTURE_2D, tex);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &levelWidth);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &levelHeight);
+        if (w == levelWidth && h == levelHeight)
+        {
+            glBarriers().textureAccess(tex, GL_TEXTURE_UPDATE_BARRIER_BIT);
+            glGetTexImage(GL_TEXTURE_2D, 0, format, GL_UNSIGNED_BYTE, pixels);
+            return;
+        }
+    }
+    // No sub-image read before GL 4.5: read the pixels through a framebuffer
+    glBarriers().textureAccess(tex, GL_FRAMEBUFFER_BARRIER_BIT);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(x, y, w, h, format, GL_UNSIGNED_BYTE, pixels);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+}
+
+// Immutable buffer ('target' is only used by the bind-to-edit path, which leaves the buffer bound to it)
+GLuint createBufferStorage(GLenum target, size_t size, const void *data, GLbitfield flags)
+{
+    GLuint buffer;
+    if (glUseDSA())
+    {
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, size, data, flags);
+        return buffer;
+    }
+    glGenBuffers(1, &buffer);
+    glState().bindBuffer(target, buffer);
+    glBufferStorage(target, size, data, flags);
+    return buffer;
+}
+
+void *mapBufferRange(GLenum target, GLuint buffer, size_t offset, size_t size, GLbitfield access)
+{
+    glBarriers().bufferAccess(buffer, GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (glUseDSA())
+    {
+        return glMapNamedBufferRange(buffer, offset, size, access);
+    }
+    glState().bindBuffer(target, buffer);
+    return glMapBufferRange(target, offset, size, access);
+}
+
+void unmapBuffer(GLenum target, GLuint buffer)
+{
+    if (glUseDSA())
+    {
+        glUnmapNamedBuffer(buffer);
+        return;
+    }
+    glState().bindBuffer(target, buffer);
+    glUnmapBuffer(target);
+}
+
+void getBufferData(GLenum target, GLuint buffer, size_t offset, size_t size, void *data)
+{
+    glBarriers().bufferAccess(buffer, GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (glUseDSA())
+    {
+        glGetNamedBufferSubData(buffer, offset, size, data);
+        return;
+    }
+    glState().bindBuffer(target, buffer);
+    glGetBufferSubData(target, offset, size, data);
+}
+
+// Write 'size' bytes at 'offset' of 'buffer' (immutable buffers need GL_DYNAMIC_STORAGE_BIT)
+void updateBufferData(GLenum target, GLuint buffer, size_t offset, size_t size, const void *data)
+{
+    glBarriers().bufferAccess(buffer, GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (glUseDSA())
+    {
+        glNamedBufferSubData(buffer, offset, size, data);
+        return;
+    }
+    glState().bindBuffer(target, buffer);
+    glBufferSubData(target, offset, size, data);
+}
+
+// Fill 'buffer' with zeros
+void clearBufferData(GLenum target, GLuint buffer)
+{
+    glBarriers().bufferAccess(buffer, GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (glUseDSA())
+    {
+        glClearNamedBufferData(buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        return;
+    }
+    glState().bindBuffer(target, buffer);
+    glClearBufferData(target, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
+void copyBufferData(GLuint source, GLuint destination, size_t sourceOffset, size_t destinationOffset, size_t size)
+{
+    glBarriers().bufferAccess(source, GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBarriers().bufferAccess(destination, GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (glUseDSA())
+    {
+        glCopyNamedBufferSubData(source, destination, sourceOffset, destinationOffset, size);
+        return;
+    }
+    glState().bindBuffer(GL_COPY_READ_BUFFER, source);
+    glState().bindBuffer(GL_COPY_WRITE_BUFFER, destination);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sourceOffset, destinationOffset, size);
+}
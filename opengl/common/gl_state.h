@@ -0,0 +1,308 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Cache of the GL bindings (program, buffers, image units, active texture and 2D textures)
+// and of the integer uniforms set through it, skipping the calls that would not change
+// anything: with many small dispatches, the driver CPU overhead of redundant state
+// changes is measurable. There is one cache per thread, i.e. per context since a context
+// is current on a single thread.
+//
+// The cache is only right if every binding goes through it, objects included: deleting
+// a bound object resets its bindings, and its name can be reused by the next glGen*,
+// hence deleteTextures()/deleteBuffers()/deleteProgram(). Call invalidate() after
+// running code that binds objects (or sets the cached uniforms) directly.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <utility>
+#include <vector>
+#include <GL/gl3w.h>
+
+class GLStateCache
+{
+public:
+    void useProgram(GLuint program)
+    {
+        if (count(program == currentProgram))
+            return;
+        glUseProgram(program);
+        currentProgram = program;
+    }
+
+    void bindBuffer(GLenum target, GLuint buffer)
+    {
+        GLuint *binding = bufferBinding(target);
+        if (binding && count(*binding == buffer))
+            return;
+        glBindBuffer(target, buffer);
+        if (binding)
+            *binding = buffer;
+    }
+
+    // Also binds the generic 'target' binding point, as glBindBufferBase does
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    {
+        std::vector<GLuint> *bindings = indexedBindings(target);
+        GLuint *binding = bindings ? &at(*bindings, index, GLuint(Unknown)) : nullptr;
+        GLuint *generic = bufferBinding(target);
+        if (binding && generic && count(*binding == buffer && *generic == buffer))
+            return;
+        glBindBufferBase(target, index, buffer);
+        if (binding)
+            *binding = buffer;
+        if (generic)
+            *generic = buffer;
+    }
+
+    void bindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format)
+    {
+        ImageBinding binding = {texture, level, layered, layer, access, format};
+        ImageBinding &current = at(imageUnits, unit, ImageBinding());
+        if (count(current == binding))
+            return;
+        glBindImageTexture(unit, texture, level, layered, layer, access, format);
+        current = binding;
+    }
+
+    void programUniform1i(GLuint program, GLint location, GLint x)
+    {
+        UniformValue value = {1, x, 0};
+        UniformValue &current = uniforms[std::make_pair(program, location)];
+        if (count(current == value))
+            return;
+        glProgramUniform1i(program, location, x);
+        current = value;
+    }
+
+    void programUniform2i(GLuint program, GLint location, GLint x, GLint y)
+    {
+        UniformValue value = {2, x, y};
+        UniformValue &current = uniforms[std::make_pair(program, location)];
+        if (count(current == value))
+            return;
+        glProgramUniform2i(program, location, x, y);
+        current = value;
+    }
+
+    // 'unit' is GL_TEXTURE0 + i
+    void activeTexture(GLenum unit)
+    {
+        if (count(unit == currentActiveTexture))
+            return;
+        glActiveTexture(unit);
+        currentActiveTexture = unit;
+    }
+
+    void bindTexture(GLenum target, GLuint texture)
+    {
+        if (target != GL_TEXTURE_2D || currentActiveTexture == Unknown)
+        {
+            glBindTexture(target, texture);
+            ++issuedCount;
+            return;
+        }
+        GLuint &binding = at(textures2D, currentActiveTexture - GL_TEXTURE0, GLuint(Unknown));
+        if (count(binding == texture))
+            return;
+        glBindTexture(target, texture);
+        binding = texture;
+    }
+
+    void deleteTextures(GLsizei n, const GLuint *names)
+    {
+        for (GLsizei i = 0; i < n; ++i)
+        {
+            forget(textures2D, names[i]);
+            for (auto &binding : imageUnits)
+            {
+                if (binding.texture == names[i])
+                    binding = ImageBinding();
+            }
+        }
+        glDeleteTextures(n, names);
+    }
+
+    void deleteBuffers(GLsizei n, const GLuint *names)
+    {
+        for (GLsizei i = 0; i < n; ++i)
+        {
+            for (auto &binding : buffers)
+            {
+                if (binding == names[i])
+                    binding = Unknown;
+            }
+            forget(shaderStorageBindings, names[i]);
+            forget(uniformBindings, names[i]);
+            forget(atomicCounterBindings, names[i]);
+        }
+        glDeleteBuffers(n, names);
+    }
+
+    void deleteProgram(GLuint program)
+    {
+        if (program == currentProgram)
+            currentProgram = Unknown;
+        uniforms.erase(uniforms.lower_bound(std::make_pair(program, GLint(INT32_MIN))),
+                       uniforms.upper_bound(std::make_pair(program, GLint(INT32_MAX))));
+        glDeleteProgram(program);
+    }
+
+    // Forget everything (code bypassing the cache, new context...)
+    void invalidate()
+    {
+        currentProgram = Unknown;
+        currentActiveTexture = Unknown;
+        for (auto &binding : buffers)
+            binding = Unknown;
+        shaderStorageBindings.clear();
+        uniformBindings.clear();
+        atomicCounterBindings.clear();
+        imageUnits.clear();
+        textures2D.clear();
+        uniforms.clear();
+    }
+
+    uint64_t issued() const
+    {
+        return issuedCount;
+    }
+
+    uint64_t skipped() const
+    {
+        return skippedCount;
+    }
+
+    void print(FILE *out) const
+    {
+        fprintf(out, "GL state changes  = %llu issued, %llu skipped\n",
+                static_cast<unsigned long long>(issuedCount), static_cast<unsigned long long>(skippedCount));
+    }
+
+private:
+    static const GLuint Unknown = 0xFFFFFFFF;
+
+    struct ImageBinding
+    {
+        GLuint texture = Unknown;
+        GLint level = 0;
+        GLboolean layered = GL_FALSE;
+        GLint layer = 0;
+        GLenum access = 0;
+        GLenum format = 0;
+
+        bool operator==(const ImageBinding &other) const
+        {
+            return texture == other.texture && level == other.level && layered == other.layered &&
+                   layer == other.layer && access == other.access && format == other.format;
+        }
+    };
+
+    // Value of an integer uniform, 'components' being 0 until it is set through the cache
+    struct UniformValue
+    {
+        int components = 0;
+        GLint x = 0;
+        GLint y = 0;
+
+        bool operator==(const UniformValue &other) const
+        {
+            return components == other.components && x == other.x && y == other.y;
+        }
+    };
+
+    // Count the call as skipped if 'redundant', as issued otherwise
+    bool count(bool redundant)
+    {
+        ++(redundant ? skippedCount : issuedCount);
+        return redundant;
+    }
+
+    // Binding 'index', unknown until it is set through the cache
+    template <typename T>
+    static T &at(std::vector<T> &bindings, GLuint index, T unknown)
+    {
+        if (index >= bindings.size())
+            bindings.resize(index + 1, unknown);
+        return bindings[index];
+    }
+
+    static void forget(std::vector<GLuint> &bindings, GLuint name)
+    {
+        for (auto &binding : bindings)
+        {
+            if (binding == name)
+                binding = Unknown;
+        }
+    }
+
+    // Cached generic binding of 'target', nullptr if this target is not cached
+    GLuint *bufferBinding(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_ARRAY_BUFFER:
+            return &buffers[0];
+        case GL_COPY_READ_BUFFER:
+            return &buffers[1];
+        case GL_COPY_WRITE_BUFFER:
+            return &buffers[2];
+        case GL_PIXEL_PACK_BUFFER:
+            return &buffers[3];
+        case GL_PIXEL_UNPACK_BUFFER:
+            return &buffers[4];
+        case GL_SHADER_STORAGE_BUFFER:
+            return &buffers[5];
+        case GL_UNIFORM_BUFFER:
+            return &buffers[6];
+        case GL_DISPATCH_INDIRECT_BUFFER:
+            return &buffers[7];
+        case GL_ATOMIC_COUNTER_BUFFER:
+            return &buffers[8];
+        default:
+            return nullptr;
+        }
+    }
+
+    std::vector<GLuint> *indexedBindings(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_SHADER_STORAGE_BUFFER:
+            return &shaderStorageBindings;
+        case GL_UNIFORM_BUFFER:
+            return &uniformBindings;
+        case GL_ATOMIC_COUNTER_BUFFER:
+            return &atomicCounterBindings;
+        default:
+            return nullptr;
+        }
+    }
+
+    GLuint currentProgram = Unknown;
+    GLenum currentActiveTexture = Unknown;
+    GLuint buffers[9] = {Unknown, Unknown, Unknown, Unknown, Unknown, Unknown, Unknown, Unknown, Unknown};
+    std::vector<GLuint> shaderStorageBindings;
+    std::vector<GLuint> uniformBindings;
+    std::vector<GLuint> atomicCounterBindings;
+    std::vector<ImageBinding> imageUnits;
+    std::vector<GLuint> textures2D; // Per texture unit
+    std::map<std::pair<GLuint, GLint>, UniformValue> uniforms; // Per (program, location)
+    uint64_t issuedCount = 0;
+    uint64_t skippedCount = 0;
+};
+
+// Cache of the context current on the calling thread
+GLStateCache &glState()
+{
+    static thread_local GLStateCache cache;
+    return cache;
+}
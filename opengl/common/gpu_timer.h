@@ -0,0 +1,204 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// GPU timings of named scopes (upload, dispatch, readback...) that never stall the pipeline:
+// each scope is delimited by two GL_TIMESTAMP queries taken from a pool, and results are
+// only read once GL_QUERY_RESULT_AVAILABLE reports them, typically a few frames later.
+//
+//   GPUTimerPool timers;
+//   for (each frame) {
+//       timers.begin("dispatch");
+//       glDispatchCompute(...);
+//       timers.end("dispatch");
+//       timers.resolve(); // Non blocking
+//   }
+//   timers.flush();
+//   timers.print(stdout);
+
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "helper.h"
+
+class GPUTimerPool
+{
+public:
+    struct Stats
+    {
+        size_t count = 0;
+        double minMs = 0.0;
+        double meanMs = 0.0;
+        double p99Ms = 0.0;
+        double maxMs = 0.0;
+    };
+
+    GPUTimerPool() = default;
+    GPUTimerPool(const GPUTimerPool &) = delete;
+    GPUTimerPool &operator=(const GPUTimerPool &) = delete;
+
+    ~GPUTimerPool()
+    {
+        if (!allQueries.empty())
+        {
+            glDeleteQueries(static_cast<GLsizei>(allQueries.size()), allQueries.data());
+        }
+    }
+
+    // Record the GPU timestamp at which the commands issued after this call start
+    void begin(const std::string &scope)
+    {
+        GLuint query = acquireQuery();
+        glQueryCounter(query, GL_TIMESTAMP);
+        openScopes[scope] = query;
+    }
+
+    // Record the GPU timestamp at which the commands of the scope are complete
+    void end(const std::string &scope)
+    {
+        auto it = openScopes.find(scope);
+        if (it == openScopes.end())
+        {
+            fprintf(stderr, "GPUTimerPool: end() without begin() for scope '%s'\n", scope.c_str());
+            return;
+        }
+        GLuint query = acquireQuery();
+        glQueryCounter(query, GL_TIMESTAMP);
+        pending.push_back({scope, it->second, query});
+        openScopes.erase(it);
+    }
+
+    // Read the results that are available without waiting. Queries complete in
+    // submission order, so polling stops at the first one not yet available.
+    void resolve()
+    {
+        while (!pending.empty())
+        {
+            GLint available = GL_FALSE;
+            glGetQueryObjectiv(pending.front().endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                return;
+            }
+            retireFront();
+        }
+    }
+
+    // Wait for all the pending results (e.g. before printing the statistics)
+    void flush()
+    {
+        while (!pending.empty())
+        {
+            retireFront();
+        }
+    }
+
+    // Called with the raw GPU timestamps (ns) of every resolved scope, e.g. to build a trace
+    void setResolvedCallback(std::function<void(const std::string &, GLuint64, GLuint64)> callback)
+    {
+        resolvedCallback = std::move(callback);
+    }
+
+    size_t pendingCount() const
+    {
+        return pending.size();
+    }
+
+    // Min, mean, p99 and max duration of every scope, in ms
+    std::map<std::string, Stats> stats() const
+    {
+        std::map<std::string, Stats> result;
+        for (auto &scope : samples)
+        {
+            std::vector<double> durations = scope.second;
+            std::sort(durations.begin(), durations.end());
+            Stats &stats = result[scope.first];
+            stats.count = durations.size();
+            if (durations.empty())
+            {
+                continue;
+            }
+            double sum = 0.0;
+            for (double d : durations)
+            {
+                sum += d;
+            }
+            stats.minMs = durations.front();
+            stats.meanMs = sum / durations.size();
+            stats.p99Ms = sortedPercentile(durations, 99);
+            stats.maxMs = durations.back();
+        }
+        return result;
+    }
+
+    void print(FILE *out) const
+    {
+        fprintf(out, "%-20s %8s %12s %12s %12s %12s\n", "GPU scope", "count", "min ms", "mean ms", "p99 ms", "max ms");
+        for (auto &scope : stats())
+        {
+            const Stats &s = scope.second;
+            fprintf(out, "%-20s %8zu %12f %12f %12f %12f\n", scope.first.c_str(), s.count, s.minMs, s.meanMs, s.p99Ms, s.maxMs);
+        }
+    }
+
+private:
+    struct PendingScope
+    {
+        std::string name;
+        GLuint beginQuery;
+        GLuint endQuery;
+    };
+
+    GLuint acquireQuery()
+    {
+        if (freeQueries.empty())
+        {
+            // Grow the pool by batches to keep glGenQueries out of the measured loops
+            size_t batch = allQueries.empty() ? 32 : allQueries.size();
+            std::vector<GLuint> queries(batch);
+            glGenQueries(static_cast<GLsizei>(batch), queries.data());
+            allQueries.insert(allQueries.end(), queries.begin(), queries.end());
+            freeQueries.insert(freeQueries.end(), queries.begin(), queries.end());
+        }
+        GLuint query = freeQueries.back();
+        freeQueries.pop_back();
+        return query;
+    }
+
+    void retireFront()
+    {
+        PendingScope scope = pending.front();
+        pending.pop_front();
+        GLuint64 beginNs = 0;
+        GLuint64 endNs = 0;
+        glGetQueryObjectui64v(scope.beginQuery, GL_QUERY_RESULT, &beginNs);
+        glGetQueryObjectui64v(scope.endQuery, GL_QUERY_RESULT, &endNs);
+        samples[scope.name].push_back(endNs > beginNs ? (endNs - beginNs) * 1e-6 : 0.0);
+        if (resolvedCallback)
+        {
+            resolvedCallback(scope.name, beginNs, endNs);
+        }
+        freeQueries.push_back(scope.beginQuery);
+        freeQueries.push_back(scope.endQuery);
+    }
+
+    std::vector<GLuint> allQueries;
+    std::vector<GLuint> freeQueries;
+    std::map<std::string, GLuint> openScopes;
+    std::deque<PendingScope> pending;
+    std::map<std::string, std::vector<double>> samples;
+    std::function<void(const std::string &, GLuint64, GLuint64)> resolvedCallback;
+};
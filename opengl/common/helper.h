@@ -11,10 +11,18 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #ifdef __linux__
 #include <unistd.h>
 #include <libgen.h>
+#elif _WIN32
+#include <direct.h>
 #endif
 
 bool loadFile(const std::string &filename, std::string &data)
@@ -104,4 +112,145 @@ std::string getBinDirectory() {
 #else
     return "";
 #endif
-}
\ No newline at end of file
+}
+
+// Return true if 'option' (e.g. "--stream") is part of the command line
+bool hasOption(int argc, char **argv, const std::string &option)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (option == argv[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return the argument following 'option' (e.g. "--size 640x480"),
+// or 'defaultValue' if the option is not part of the command line
+std::string getOptionValue(int argc, char **argv, const std::string &option, const std::string &defaultValue = "")
+{
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (option == argv[i])
+        {
+            return argv[i + 1];
+        }
+    }
+    return defaultValue;
+}
+
+// Parse 'text' as an integer in [minValue, maxValue] (e.g. an option value)
+bool parseInt(const std::string &text, int minValue, int maxValue, int &value)
+{
+    char *end = nullptr;
+    long parsed = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || parsed < minValue || parsed > maxValue)
+    {
+        return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+// Return the arguments that are neither options nor option values (e.g. input files).
+// 'valueOptions' lists the options followed by a value.
+std::vector<std::string> getPositionalArguments(int argc, char **argv, const std::vector<std::string> &valueOptions)
+{
+    std::vector<std::string> arguments;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (std::find(valueOptions.begin(), valueOptions.end(), arg) != valueOptions.end())
+        {
+            ++i;
+        }
+        else if (arg.compare(0, 2, "--") != 0)
+        {
+            arguments.push_back(arg);
+        }
+    }
+    return arguments;
+}
+
+// 64-bit FNV-1a hash, 'seed' allows to chain several buffers
+uint64_t hashFNV1a(const void *data, size_t size, uint64_t seed = 14695981039346656037ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Create 'path' and its missing parents, return false if it does not exist afterwards
+bool createDirectories(const std::string &path)
+{
+    std::string target = path;
+    while (target.size() > 1 && (target.back() == '/' || target.back() == '\\'))
+    {
+        target.pop_back();
+    }
+    for (std::string::size_type pos = target.find_first_of("/\\", 1); ; pos = target.find_first_of("/\\", pos + 1))
+    {
+        std::string dir = target.substr(0, pos);
+#ifdef _WIN32
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0755);
+#endif
+        if (pos == std::string::npos)
+        {
+            break;
+        }
+    }
+    struct stat info;
+    return stat(target.c_str(), &info) == 0 && (info.st_mode & S_IFDIR);
+}
+
+// Per-user cache directory of the samples (ends with a path separator),
+// overridden by the CS_CACHE_DIR environment variable
+std::string getCacheDirectory()
+{
+    const char *overrideDir = getenv("CS_CACHE_DIR");
+    if (overrideDir)
+    {
+        return *overrideDir ? std::string(overrideDir) + "/" : "";
+    }
+#ifdef _WIN32
+    const char *localAppData = getenv("LOCALAPPDATA");
+    return localAppData ? std::string(localAppData) + "\\compute_shader_samples\\" : "";
+#else
+    const char *xdgCache = getenv("XDG_CACHE_HOME");
+    if (xdgCache && *xdgCache)
+    {
+        return std::string(xdgCache) + "/compute_shader_samples/";
+    }
+    const char *home = getenv("HOME");
+    return home ? std::string(home) + "/.cache/compute_shader_samples/" : "";
+#endif
+}
+
+// Nearest-rank percentile 'p' (0-100) of 'sorted', in ascending order: the smallest value
+// such that p% of the values are less or equal to it
+double sortedPercentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    double rank = ceil(p * sorted.size() / 100.0);
+    size_t index = rank > 1.0 ? static_cast<size_t>(rank) - 1 : 0;
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Same as sortedPercentile() on unsorted 'values' (sort once for several percentiles)
+double percentile(std::vector<double> values, double p)
+{
+    std::sort(values.begin(), values.end());
+    return sortedPercentile(values, p);
+}
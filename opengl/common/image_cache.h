@@ -0,0 +1,243 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Cache of decoded images: the RGBA pixels of an encoded file (JPEG, PNG...) are stored
+// in $XDG_CACHE_HOME/compute_shader_samples/images (see getCacheDirectory()), keyed by
+// the hash of the file content, and memory mapped by the next loads instead of being
+// decoded again. Files are only added by a prewarm (prewarmImageCache(), --prewarm-cache
+// option of the samples) or on every miss with CS_IMAGE_CACHE=on; CS_IMAGE_CACHE=off
+// disables lookups.
+//
+// File layout: "CSIM" magic, version, width, height, size and hash of the source file,
+// then width * height RGBA pixels.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "helper.h"
+
+struct ImageCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+};
+
+static const uint32_t ImageCacheVersion = 1;
+
+// "off": no lookup, "on": store every decoded image, unset: lookups only
+std::string getImageCacheMode()
+{
+    const char *mode = getenv("CS_IMAGE_CACHE");
+    return mode ? mode : "";
+}
+
+// Whole content of a binary file
+bool readBinaryFile(const std::string &filename, std::vector<uint8_t> &content)
+{
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f)
+    {
+        return false;
+    }
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long size = ok ? ftell(f) : -1;
+    ok = size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+    if (ok)
+    {
+        content.resize(static_cast<size_t>(size));
+        ok = fread(content.data(), 1, content.size(), f) == content.size();
+    }
+    fclose(f);
+    return ok;
+}
+
+bool imageCacheEnabled()
+{
+    return !getCacheDirectory().empty() && getImageCacheMode() != "off";
+}
+
+// Key of an encoded image in the cache
+uint64_t getImageCacheKey(const std::vector<uint8_t> &content)
+{
+    return hashFNV1a(content.data(), content.size());
+}
+
+// Cache file of the image of key 'key', empty if the cache is disabled
+std::string getImageCachePath(uint64_t key)
+{
+    if (!imageCacheEnabled())
+    {
+        return "";
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.rgba", static_cast<unsigned long long>(key));
+    return getCacheDirectory() + "images/" + name;
+}
+
+// Read-only memory mapping of a cached image, checked against the key and size of the source file
+class CachedImage
+{
+public:
+    CachedImage() = default;
+    CachedImage(const CachedImage &) = delete;
+    CachedImage &operator=(const CachedImage &) = delete;
+
+    ~CachedImage()
+    {
+        close();
+    }
+
+    bool open(const std::string &path, uint64_t key, size_t sourceSize)
+    {
+        close();
+        if (path.empty() || !map(path))
+        {
+            return false;
+        }
+        ImageCacheHeader header;
+        if (size < sizeof(header))
+        {
+            close();
+            return false;
+        }
+        memcpy(&header, mapped, sizeof(header));
+        bool valid = memcmp(header.magic, "CSIM", 4) == 0 && header.version == ImageCacheVersion &&
+                     header.width > 0 && header.height > 0 && header.sourceSize == sourceSize && header.sourceHash == key &&
+                     size == sizeof(header) + static_cast<size_t>(header.width) * header.height * 4;
+        if (!valid)
+        {
+            close();
+            return false;
+        }
+        width = static_cast<int>(header.width);
+        height = static_cast<int>(header.height);
+        pixels = mapped + sizeof(header);
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (mapped)
+            UnmapViewOfFile(mapped);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (mapped)
+            munmap(mapped, size);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        mapped = nullptr;
+        pixels = nullptr;
+        size = 0;
+    }
+
+    const uint8_t *pixels = nullptr; // width * height RGBA pixels
+    int width = 0;
+    int height = 0;
+
+private:
+    bool map(const std::string &path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            return false;
+        size = static_cast<size_t>(fileSize.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return false;
+        mapped = static_cast<uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size));
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+            return false;
+        size = static_cast<size_t>(info.st_size);
+        void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        mapped = ptr == MAP_FAILED ? nullptr : static_cast<uint8_t *>(ptr);
+#endif
+        return mapped != nullptr;
+    }
+
+    uint8_t *mapped = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Store the w x h RGBA 'pixels' of the image of key 'key' in the cache file 'path'
+bool storeCachedImage(const std::string &path, uint64_t key, size_t sourceSize, int w, int h, const uint8_t *pixels)
+{
+    if (path.empty() || !createDirectories(parentDirectory(path)))
+    {
+        return false;
+    }
+    ImageCacheHeader header;
+    memcpy(header.magic, "CSIM", 4);
+    header.version = ImageCacheVersion;
+    header.width = static_cast<uint32_t>(w);
+    header.height = static_cast<uint32_t>(h);
+    header.sourceSize = sourceSize;
+    header.sourceHash = key;
+
+    // Temporary file + rename: concurrent loads never map a partial image
+    std::string threadId = std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#ifdef _WIN32
+    std::string tmpPath = path + "." + std::to_string(GetCurrentProcessId()) + "." + threadId + ".tmp";
+#else
+    std::string tmpPath = path + "." + std::to_string(getpid()) + "." + threadId + ".tmp";
+#endif
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+    {
+        return false;
+    }
+    size_t payload = static_cast<size_t>(w) * h * 4;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(pixels, 1, payload, f) == payload;
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    remove(path.c_str()); // rename does not replace an existing file on Windows
+#endif
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,296 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Image loading straight into GPU staging memory. stb_image allocates its output with
+// STBI_MALLOC: once the image size is known (stbi_info), the staging memory of the
+// upload (see upload.h) is handed out for the allocation of the size of the RGBA output,
+// so that the decoder writes the pixels exactly once before the GPU reads them.
+// The staging memory is write-combined and must never be read, so this is only done for
+// JPEG files, whose decoder only writes its output. Other formats (PNG unfiltering reads
+// the previous output row...) and the decoder paths that do not end in that allocation
+// are decoded on the heap and copied into the staging memory. Images found in the decoded
+// image cache (see image_cache.h) are copied from the mapped cache file, without decoding.
+// Baseline JPEG files with restart markers are decoded by several threads (see jpeg_decoder.h).
+//
+// This header holds the stb_image implementation: include it instead of defining
+// STB_IMAGE_IMPLEMENTATION.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "image_cache.h"
+#include "upload.h"
+
+// Staging memory offered to the next allocation of the calling thread in [minSize, maxSize]
+struct StagingTarget
+{
+    uint8_t *data = nullptr;
+    size_t minSize = 0;
+    size_t maxSize = 0;
+    size_t allocatedSize = 0; // Size requested by the allocation using the staging memory
+    bool inUse = false;
+};
+
+static StagingTarget &stagingTarget()
+{
+    static thread_local StagingTarget target;
+    return target;
+}
+
+static void *stagingMalloc(size_t size)
+{
+    StagingTarget &target = stagingTarget();
+    if (target.data && !target.inUse && size >= target.minSize && size <= target.maxSize)
+    {
+        target.inUse = true;
+        target.allocatedSize = size;
+        return target.data;
+    }
+    return malloc(size);
+}
+
+static void stagingFree(void *p)
+{
+    StagingTarget &target = stagingTarget();
+    if (p && p == target.data)
+    {
+        // Intermediate buffer that happened to match: the staging memory is available again
+        target.inUse = false;
+        return;
+    }
+    free(p);
+}
+
+static void *stagingRealloc(void *p, size_t size)
+{
+    StagingTarget &target = stagingTarget();
+    if (p && p == target.data)
+    {
+        // The staging memory cannot grow: move to the heap
+        void *moved = malloc(size);
+        if (moved)
+        {
+            memcpy(moved, p, size < target.allocatedSize ? size : target.allocatedSize);
+            target.inUse = false;
+        }
+        return moved;
+    }
+    return realloc(p, size);
+}
+
+#define STBI_MALLOC(size) stagingMalloc(size)
+#define STBI_REALLOC(p, size) stagingRealloc(p, size)
+#define STBI_FREE(p) stagingFree(p)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "jpeg_decoder.h"
+
+// Whether 'size' bytes of 'encoded' are a JPEG file
+static bool isJPEG(const stbi_uc *encoded, size_t size)
+{
+    stbi__context context;
+    stbi__start_mem(&context, encoded, static_cast<int>(size));
+    return stbi__jpeg_test(&context) != 0;
+}
+
+// Decode 'size' bytes of 'encoded' as RGBA on the heap (released with stbi_image_free)
+static stbi_uc *decodeImageRGBA(const stbi_uc *encoded, size_t size, int &w, int &h)
+{
+    ParallelJpegDecoder jpeg;
+    if (jpegParallelEnabled() && jpeg.parse(encoded, size))
+    {
+        stbi_uc *pixels = static_cast<stbi_uc *>(STBI_MALLOC(static_cast<size_t>(jpeg.width()) * jpeg.height() * 4));
+        if (pixels && jpeg.decode(pixels))
+        {
+            w = jpeg.width();
+            h = jpeg.height();
+            return pixels;
+        }
+        stbi_image_free(pixels);
+    }
+    int numChannels;
+    return stbi_load_from_memory(encoded, static_cast<int>(size), &w, &h, &numChannels, 4);
+}
+
+// Decode 'filename' as RGBA into 'staging', allocated from 'uploads'.
+// 'inPlace' tells whether the decoder wrote into the staging memory directly.
+bool loadImageRGBA(const std::string &filename, UploadRing &uploads, UploadRing::Allocation &staging,
+                   int &w, int &h, bool *inPlace = nullptr)
+{
+    std::vector<uint8_t> content;
+    if (!readBinaryFile(filename, content))
+    {
+        return false;
+    }
+    if (inPlace)
+    {
+        *inPlace = false;
+    }
+
+    // Already decoded by a previous run
+    std::string cachePath;
+    uint64_t cacheKey = 0;
+    if (imageCacheEnabled())
+    {
+        cacheKey = getImageCacheKey(content);
+        cachePath = getImageCachePath(cacheKey);
+        CachedImage cached;
+        if (cached.open(cachePath, cacheKey, content.size()))
+        {
+            w = cached.width;
+            h = cached.height;
+            size_t size = static_cast<size_t>(w) * h * 4;
+            staging = uploads.allocate(size);
+            memcpy(staging.data, cached.pixels, size);
+            return true;
+        }
+    }
+
+    int numChannels;
+    const stbi_uc *encoded = content.data();
+    int encodedSize = static_cast<int>(content.size());
+    if (!stbi_info_from_memory(encoded, encodedSize, &w, &h, &numChannels) || w <= 0 || h <= 0)
+    {
+        return false;
+    }
+    if (!cachePath.empty() && getImageCacheMode() == "on")
+    {
+        // Decoded on the heap: reading back the write-combined staging memory to store it would be slow
+        int decodedW, decodedH;
+        stbi_uc *pixels = decodeImageRGBA(encoded, content.size(), decodedW, decodedH);
+        if (!pixels || decodedW != w || decodedH != h)
+        {
+            stbi_image_free(pixels);
+            return false;
+        }
+        storeCachedImage(cachePath, cacheKey, content.size(), w, h, pixels);
+        size_t size = static_cast<size_t>(w) * h * 4;
+        staging = uploads.allocate(size);
+        memcpy(staging.data, pixels, size);
+        stbi_image_free(pixels);
+        return true;
+    }
+    {
+        // Written by the decoding threads
+        ParallelJpegDecoder jpeg;
+        if (jpegParallelEnabled() && jpeg.parse(encoded, content.size()) && jpeg.width() == w && jpeg.height() == h)
+        {
+            staging = uploads.allocate(static_cast<size_t>(w) * h * 4);
+            if (jpeg.decode(staging.data))
+            {
+                if (inPlace)
+                {
+                    *inPlace = true;
+                }
+                return true;
+            }
+            uploads.discard(staging);
+        }
+    }
+
+    // The JPEG decoder allocates a few extra bytes (+1), the slack is kept small so that
+    // its intermediate buffers do not match
+    size_t size = static_cast<size_t>(w) * h * 4;
+    size_t slack = 16;
+    staging = uploads.allocate(size + slack);
+
+    StagingTarget &target = stagingTarget();
+    if (isJPEG(encoded, content.size()))
+    {
+        target.data = staging.data;
+        target.minSize = size;
+        target.maxSize = size + slack;
+        target.inUse = false;
+    }
+    int decodedW, decodedH;
+    stbi_uc *pixels = stbi_load_from_memory(encoded, encodedSize, &decodedW, &decodedH, &numChannels, 4);
+    bool direct = pixels && pixels == staging.data;
+    target = StagingTarget();
+
+    if (!pixels || decodedW != w || decodedH != h)
+    {
+        if (pixels && !direct)
+            stbi_image_free(pixels);
+        uploads.discard(staging);
+        return false;
+    }
+    if (!direct)
+    {
+        memcpy(staging.data, pixels, size);
+        stbi_image_free(pixels);
+    }
+    if (inPlace)
+    {
+        *inPlace = direct;
+    }
+    return true;
+}
+
+// Load 'filename' into a RGBA8UI texture taken from 'textures' (0 on failure)
+GLuint loadTexture(const std::string &filename, UploadRing &uploads, TexturePool &textures, int &w, int &h)
+{
+    UploadRing::Allocation staging;
+    if (!loadImageRGBA(filename, uploads, staging, w, h))
+    {
+        return 0;
+    }
+    GLuint tex = textures.acquire(GL_RGBA8UI, w, h);
+    uploads.uploadTexture(staging, tex, w, h);
+    return tex;
+}
+
+// Decode 'filenames' into the image cache, so that the next loads skip decoding.
+// Does not need a GL context. Returns the number of files that could not be cached.
+int prewarmImageCache(const std::vector<std::string> &filenames)
+{
+    if (!imageCacheEnabled())
+    {
+        fprintf(stderr, "The image cache is disabled (CS_CACHE_DIR or CS_IMAGE_CACHE)\n");
+        return static_cast<int>(filenames.size());
+    }
+    int failures = 0;
+    for (auto &filename : filenames)
+    {
+        std::vector<uint8_t> content;
+        if (!readBinaryFile(filename, content))
+        {
+            fprintf(stderr, "Failed to read '%s'\n", filename.c_str());
+            ++failures;
+            continue;
+        }
+        uint64_t key = getImageCacheKey(content);
+        std::string path = getImageCachePath(key);
+        CachedImage cached;
+        if (cached.open(path, key, content.size()))
+        {
+            printf("'%s' already cached (%ix%i)\n", filename.c_str(), cached.width, cached.height);
+            continue;
+        }
+        int w, h;
+        stbi_uc *pixels = decodeImageRGBA(content.data(), content.size(), w, h);
+        if (!pixels || !storeCachedImage(path, key, content.size(), w, h, pixels))
+        {
+            fprintf(stderr, "Failed to cache '%s'\n", filename.c_str());
+            ++failures;
+        }
+        else
+        {
+            printf("'%s' cached to '%s' (%ix%i)\n", filename.c_str(), path.c_str(), w, h);
+        }
+        stbi_image_free(pixels);
+    }
+    return failures;
+}
@@ -0,0 +1,366 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Image output in the format given by the file extension:
+//   .png          parallel deflate (see png_writer.h)
+//   .pam          uncompressed RGBA (netpbm P7)
+//   .ppm          uncompressed RGB (netpbm P6), alpha is dropped
+//   .qoi          "Quite OK Image" lossless format, fast to encode and decode
+//   .rgba / .raw  headerless RGBA pixels
+// Every format but PNG is written through a memory mapping of the output file,
+// so pixels are copied once from the readback buffer to the file pages.
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <GL/gl3w.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "png_writer.h"
+#include "gl_resources.h"
+
+enum class ImageFormat
+{
+    PNG,
+    PAM,
+    PPM,
+    QOI,
+    RawRGBA,
+    Unknown
+};
+
+ImageFormat imageFormatFromFilename(const std::string &filename)
+{
+    std::string::size_type dot = filename.find_last_of('.');
+    std::string ext = dot == std::string::npos ? "" : filename.substr(dot + 1);
+    if (ext == "png")
+        return ImageFormat::PNG;
+    if (ext == "pam")
+        return ImageFormat::PAM;
+    if (ext == "ppm")
+        return ImageFormat::PPM;
+    if (ext == "qoi")
+        return ImageFormat::QOI;
+    if (ext == "rgba" || ext == "raw")
+        return ImageFormat::RawRGBA;
+    return ImageFormat::Unknown;
+}
+
+// Output file mapped in memory for writing. The file is created with 'size' bytes
+// and truncated to the size given to close() (e.g. for compressed formats whose
+// final size is only known once encoded).
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        close(size);
+    }
+
+    bool open(const std::string &filename, size_t fileSize)
+    {
+        size = fileSize;
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+        if (!mapping)
+            return false;
+        data = static_cast<uint8_t *>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size));
+        return data != nullptr;
+#else
+        fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(size)) != 0)
+            return false;
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        data = ptr == MAP_FAILED ? nullptr : static_cast<uint8_t *>(ptr);
+        return data != nullptr;
+#endif
+    }
+
+    // Unmap and truncate the file to 'finalSize' bytes
+    bool close(size_t finalSize)
+    {
+        bool ok = true;
+#ifdef _WIN32
+        if (data)
+            ok = UnmapViewOfFile(data) != 0;
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            LARGE_INTEGER end;
+            end.QuadPart = static_cast<LONGLONG>(finalSize);
+            ok = SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file) && ok;
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            ok = munmap(data, size) == 0;
+        if (fd >= 0)
+        {
+            ok = ftruncate(fd, static_cast<off_t>(finalSize)) == 0 && ok;
+            ok = ::close(fd) == 0 && ok;
+        }
+        fd = -1;
+#endif
+        data = nullptr;
+        return ok;
+    }
+
+    uint8_t *data = nullptr;
+    size_t size = 0;
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Header of the uncompressed formats, pixels directly follow it
+std::string uncompressedImageHeader(ImageFormat format, int w, int h)
+{
+    char header[128] = "";
+    if (format == ImageFormat::PAM)
+        snprintf(header, sizeof(header), "P7\nWIDTH %i\nHEIGHT %i\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", w, h);
+    else if (format == ImageFormat::PPM)
+        snprintf(header, sizeof(header), "P6\n%i %i\n255\n", w, h);
+    return header;
+}
+
+// Encode RGBA pixels to QOI into 'out' (at least qoiMaxSize() bytes), return the encoded size
+size_t qoiMaxSize(int w, int h)
+{
+    return 14 /* header */ + static_cast<size_t>(w) * h * 5 + 8 /* end marker */;
+}
+
+// QOI encoder taking the rows in order, a few at a time (see encodeQOI())
+class QOIEncoder
+{
+public:
+    // Write the header of a w x h image into 'out' (at least qoiMaxSize() bytes)
+    QOIEncoder(int w, int h, uint8_t *out) : w(w), out(out)
+    {
+        out[p++] = 'q';
+        out[p++] = 'o';
+        out[p++] = 'i';
+        out[p++] = 'f';
+        write32(static_cast<uint32_t>(w));
+        write32(static_cast<uint32_t>(h));
+        out[p++] = 4; // channels
+        out[p++] = 0; // sRGB with linear alpha
+    }
+
+    // Append the next 'rows' rows of the image
+    void encodeRows(const uint8_t *rgba, int rows, int strideInBytes)
+    {
+        for (int y = 0; y < rows; ++y)
+        {
+            const uint8_t *row = rgba + static_cast<size_t>(y) * strideInBytes;
+            for (int x = 0; x < w; ++x)
+            {
+                encodePixel(row + x * 4);
+            }
+        }
+    }
+
+    // Write the end marker, return the encoded size
+    size_t finish()
+    {
+        if (run > 0)
+        {
+            out[p++] = static_cast<uint8_t>(0xc0 | (run - 1)); // QOI_OP_RUN
+            run = 0;
+        }
+        static const uint8_t endMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+        memcpy(out + p, endMarker, 8);
+        return p + 8;
+    }
+
+private:
+    void write32(uint32_t v)
+    {
+        out[p++] = static_cast<uint8_t>(v >> 24);
+        out[p++] = static_cast<uint8_t>(v >> 16);
+        out[p++] = static_cast<uint8_t>(v >> 8);
+        out[p++] = static_cast<uint8_t>(v);
+    }
+
+    void encodePixel(const uint8_t *px)
+    {
+        if (memcmp(px, prev, 4) == 0)
+        {
+            ++run;
+            if (run == 62)
+            {
+                out[p++] = static_cast<uint8_t>(0xc0 | (run - 1)); // QOI_OP_RUN
+                run = 0;
+            }
+            return;
+        }
+        if (run > 0)
+        {
+            out[p++] = static_cast<uint8_t>(0xc0 | (run - 1));
+            run = 0;
+        }
+        int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        if (memcmp(index[hash], px, 4) == 0)
+        {
+            out[p++] = static_cast<uint8_t>(hash); // QOI_OP_INDEX
+        }
+        else
+        {
+            memcpy(index[hash], px, 4);
+            if (px[3] == prev[3])
+            {
+                int8_t dr = static_cast<int8_t>(px[0] - prev[0]);
+                int8_t dg = static_cast<int8_t>(px[1] - prev[1]);
+                int8_t db = static_cast<int8_t>(px[2] - prev[2]);
+                int8_t drdg = static_cast<int8_t>(dr - dg);
+                int8_t dbdg = static_cast<int8_t>(db - dg);
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+                {
+                    out[p++] = static_cast<uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)); // QOI_OP_DIFF
+                }
+                else if (drdg > -9 && drdg < 8 && dg > -33 && dg < 32 && dbdg > -9 && dbdg < 8)
+                {
+                    out[p++] = static_cast<uint8_t>(0x80 | (dg + 32)); // QOI_OP_LUMA
+                    out[p++] = static_cast<uint8_t>((drdg + 8) << 4 | (dbdg + 8));
+                }
+                else
+                {
+                    out[p++] = 0xfe; // QOI_OP_RGB
+                    out[p++] = px[0];
+                    out[p++] = px[1];
+                    out[p++] = px[2];
+                }
+            }
+            else
+            {
+                out[p++] = 0xff; // QOI_OP_RGBA
+                memcpy(out + p, px, 4);
+                p += 4;
+            }
+        }
+        memcpy(prev, px, 4);
+    }
+
+    int w;
+    uint8_t *out;
+    size_t p = 0;
+    uint8_t index[64][4] = {};
+    uint8_t prev[4] = {0, 0, 0, 255};
+    int run = 0;
+};
+
+size_t encodeQOI(int w, int h, const uint8_t *rgba, int strideInBytes, uint8_t *out)
+{
+    QOIEncoder encoder(w, h, out);
+    encoder.encodeRows(rgba, h, strideInBytes);
+    return encoder.finish();
+}
+
+// Write RGBA pixels to 'filename' in the format given by its extension
+bool writeImage(const std::string &filename, int w, int h, const uint8_t *rgba, int strideInBytes, int pngLevel = 6)
+{
+    ImageFormat format = imageFormatFromFilename(filename);
+    if (format == ImageFormat::PNG)
+    {
+        return writePNGParallel(filename, w, h, 4, rgba, strideInBytes, pngLevel);
+    }
+    if (format == ImageFormat::Unknown)
+    {
+        fprintf(stderr, "Unsupported image format '%s' (expected png, pam, ppm, qoi, rgba or raw)\n", filename.c_str());
+        return false;
+    }
+
+    MappedFile file;
+    if (format == ImageFormat::QOI)
+    {
+        if (!file.open(filename, qoiMaxSize(w, h)))
+            return false;
+        return file.close(encodeQOI(w, h, rgba, strideInBytes, file.data));
+    }
+
+    std::string header = uncompressedImageHeader(format, w, h);
+    int channels = format == ImageFormat::PPM ? 3 : 4;
+    size_t rowBytes = static_cast<size_t>(w) * channels;
+    size_t size = header.size() + rowBytes * h;
+    if (!file.open(filename, size))
+        return false;
+    memcpy(file.data, header.data(), header.size());
+    for (int y = 0; y < h; ++y)
+    {
+        const uint8_t *src = rgba + static_cast<size_t>(y) * strideInBytes;
+        uint8_t *dst = file.data + header.size() + rowBytes * y;
+        if (channels == 4)
+        {
+            memcpy(dst, src, rowBytes);
+        }
+        else
+        {
+            for (int x = 0; x < w; ++x)
+            {
+                memcpy(dst + x * 3, src + x * 4, 3);
+            }
+        }
+    }
+    return file.close(size);
+}
+
+// Save the w x h region starting at (x, y) of the RGBA8UI texture 'tex' to 'filename',
+// only this region being read back. For the uncompressed formats the driver reads the
+// pixels straight into the memory mapped output file.
+bool saveTextureRegion(GLuint tex, int x, int y, int w, int h, const std::string &filename, int pngLevel = 6)
+{
+    ImageFormat format = imageFormatFromFilename(filename);
+    if (format == ImageFormat::PAM || format == ImageFormat::PPM || format == ImageFormat::RawRGBA)
+    {
+        std::string header = uncompressedImageHeader(format, w, h);
+        int channels = format == ImageFormat::PPM ? 3 : 4;
+        size_t size = header.size() + static_cast<size_t>(w) * h * channels;
+        MappedFile file;
+        if (!file.open(filename, size))
+            return false;
+        memcpy(file.data, header.data(), header.size());
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        getTextureRegion(tex, x, y, w, h, channels == 3 ? GL_RGB_INTEGER : GL_RGBA_INTEGER, size - header.size(), file.data + header.size());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        return file.close(size);
+    }
+    std::vector<uint8_t> img(static_cast<size_t>(w) * h * 4);
+    getTextureRegion(tex, x, y, w, h, GL_RGBA_INTEGER, img.size(), img.data());
+    return writeImage(filename, w, h, img.data(), w * 4, pngLevel);
+}
+
+// Save the whole RGBA8UI texture 'tex' (w x h) to 'filename'
+bool saveTexture(GLuint tex, int w, int h, const std::string &filename, int pngLevel = 6)
+{
+    return saveTextureRegion(tex, 0, 0, w, h, filename, pngLevel);
+}
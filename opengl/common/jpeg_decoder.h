@@ -0,0 +1,532 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Multi-threaded decoding of baseline JPEG files with restart markers. The entropy-coded
+// data of such files is split by RSTn markers into segments that reset the Huffman
+// decoder and the DC predictions, hence can be decoded independently: the segments are
+// spread over a thread pool, each task decoding and inverse transforming its MCUs into
+// the shared component planes. The planes are then upsampled and converted to RGBA by
+// bands of rows, also in parallel.
+//
+// The header parsing, the Huffman decoding and the SIMD kernels (IDCT, 2x2 upsampling,
+// color conversion) are the ones of stb_image, so that the pixels are identical to
+// stbi_load(); the 2x1 and 1x2 upsamplings have SSE2 versions here.
+// Progressive files, files without restart interval, with several scans or CMYK are not
+// handled: parse() fails and the caller falls back to stb_image. CS_JPEG_PARALLEL=off
+// disables this decoder (see jpegParallelEnabled()).
+//
+// decodeCoefficients() stops after the entropy decoding, for the GPU to run the rest of
+// the decoder (see jpeg_gpu_decoder.h).
+//
+// Uses the stb_image internals: include image_loader.h, which holds the implementation.
+
+#ifndef STB_IMAGE_IMPLEMENTATION
+#error "jpeg_decoder.h needs the stb_image implementation, include image_loader.h instead"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+// False when CS_JPEG_PARALLEL=off
+bool jpegParallelEnabled()
+{
+    static const bool enabled = []() {
+        const char *env = getenv("CS_JPEG_PARALLEL");
+        std::string mode = env ? env : "";
+        return mode != "off" && mode != "0";
+    }();
+    return enabled;
+}
+
+#ifdef STBI_SSE2
+// stbi__resample_row_v_2, 16 pixels at a time
+static stbi_uc *resampleRowV2SSE2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    int i = 0;
+    for (; i + 16 <= w; i += 16)
+    {
+        __m128i nearb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in_near + i));
+        __m128i farb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in_far + i));
+        __m128i nearLo = _mm_unpacklo_epi8(nearb, zero), nearHi = _mm_unpackhi_epi8(nearb, zero);
+        __m128i farLo = _mm_unpacklo_epi8(farb, zero), farHi = _mm_unpackhi_epi8(farb, zero);
+        // (3 * near + far + 2) >> 2
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(nearLo, 1), nearLo), _mm_add_epi16(farLo, two));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(nearHi, 1), nearHi), _mm_add_epi16(farHi, two));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2)));
+    }
+    for (; i < w; ++i)
+    {
+        out[i] = stbi__div4(3 * in_near[i] + in_far[i] + 2);
+    }
+    STBI_NOTUSED(hs);
+    return out;
+}
+
+// stbi__resample_row_h_2, 8 input pixels at a time (edges as in stb_image)
+static stbi_uc *resampleRowH2SSE2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+    stbi_uc *input = in_near;
+    if (w == 1)
+    {
+        out[0] = out[1] = input[0];
+        return out;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    out[0] = input[0];
+    out[1] = stbi__div4(input[0] * 3 + input[1] + 2);
+    int i = 1;
+    // Reads input[i - 1 .. i + 8]
+    for (; i + 9 <= w; i += 8)
+    {
+        __m128i prev = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(input + i - 1)), zero);
+        __m128i curr = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(input + i)), zero);
+        __m128i next = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(input + i + 1)), zero);
+        __m128i n = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(curr, 1), curr), two);
+        __m128i even = _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(n, prev), 2), zero);
+        __m128i odd = _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(n, next), 2), zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2), _mm_unpacklo_epi8(even, odd));
+    }
+    for (; i < w - 1; ++i)
+    {
+        int n = 3 * input[i] + 2;
+        out[i * 2 + 0] = stbi__div4(n + input[i - 1]);
+        out[i * 2 + 1] = stbi__div4(n + input[i + 1]);
+    }
+    out[i * 2 + 0] = stbi__div4(input[w - 2] * 3 + input[w - 1] + 2);
+    out[i * 2 + 1] = input[w - 1];
+    STBI_NOTUSED(in_far);
+    STBI_NOTUSED(hs);
+    return out;
+}
+#endif
+
+class ParallelJpegDecoder
+{
+public:
+    ParallelJpegDecoder() = default;
+    ParallelJpegDecoder(const ParallelJpegDecoder &) = delete;
+    ParallelJpegDecoder &operator=(const ParallelJpegDecoder &) = delete;
+
+    ~ParallelJpegDecoder()
+    {
+        if (jpeg)
+        {
+            stbi__free_jpeg_components(jpeg, 4, 0);
+            free(jpeg);
+        }
+    }
+
+    // Component plane of the decoded image, before upsampling
+    struct Plane
+    {
+        int stride;    // Width of the plane, multiple of 8 (decoded MCUs overflow the image)
+        int rows;      // Height of the plane, multiple of 8
+        int height;    // Rows covered by the image
+        int hs, vs;    // Upsampling factors
+        int wLores;    // Columns covered by the image
+        const stbi__uint16 *dequant; // Quantization table in natural order
+    };
+
+    // Parse the headers of the 'size' bytes of 'data' (kept until decode()) and locate
+    // the restart markers. False if the file cannot be decoded by this decoder. Without
+    // 'needRestartMarkers', files without restart interval are decoded as a single segment.
+    bool parse(const uint8_t *data, size_t size, bool needRestartMarkers = true)
+    {
+        if (size < 4 || size > 0x7fffffff || data[0] != 0xff || data[1] != 0xd8)
+        {
+            return false;
+        }
+        stbi__start_mem(&context, data, static_cast<int>(size));
+        jpeg = static_cast<stbi__jpeg *>(calloc(1, sizeof(stbi__jpeg)));
+        if (!jpeg)
+        {
+            return false;
+        }
+        jpeg->s = &context;
+        stbi__setup_jpeg(jpeg);
+        if (!stbi__decode_jpeg_header(jpeg, STBI__SCAN_load) || jpeg->progressive)
+        {
+            return false;
+        }
+        int m = stbi__get_marker(jpeg);
+        while (!stbi__SOS(m))
+        {
+            if (stbi__EOI(m) || !stbi__process_marker(jpeg, m))
+            {
+                return false;
+            }
+            m = stbi__get_marker(jpeg);
+        }
+        if (!stbi__process_scan_header(jpeg))
+        {
+            return false;
+        }
+
+        // A single scan holding every component
+        int n = context.img_n;
+        if ((n != 1 && n != 3) || jpeg->scan_n != n || (needRestartMarkers && jpeg->restart_interval <= 0))
+        {
+            return false;
+        }
+        if (jpeg->scan_n == 1)
+        {
+            // Non-interleaved: every block is an MCU
+            const auto &comp = jpeg->img_comp[jpeg->order[0]];
+            mcuPerRow = (comp.x + 7) >> 3;
+            mcuCount = mcuPerRow * ((comp.y + 7) >> 3);
+        }
+        else
+        {
+            mcuPerRow = jpeg->img_mcu_x;
+            mcuCount = jpeg->img_mcu_x * jpeg->img_mcu_y;
+        }
+        isRGB = n == 3 && (jpeg->rgb == 3 || (jpeg->app14_color_transform == 0 && !jpeg->jfif));
+        for (int k = 0; k < n; ++k)
+        {
+            Resampler &r = resamplers[k];
+            r.hs = jpeg->img_h_max / jpeg->img_comp[k].h;
+            r.vs = jpeg->img_v_max / jpeg->img_comp[k].v;
+            r.wLores = (context.img_x + r.hs - 1) / r.hs;
+            if (r.hs == 1 && r.vs == 1)
+                r.resample = resample_row_1;
+            else if (r.hs == 1 && r.vs == 2)
+                r.resample = stbi__resample_row_v_2;
+            else if (r.hs == 2 && r.vs == 1)
+                r.resample = stbi__resample_row_h_2;
+            else if (r.hs == 2 && r.vs == 2)
+                r.resample = jpeg->resample_row_hv_2_kernel;
+            else
+                r.resample = stbi__resample_row_generic;
+#ifdef STBI_SSE2
+            if (stbi__sse2_available() && r.resample == stbi__resample_row_v_2)
+                r.resample = resampleRowV2SSE2;
+            if (stbi__sse2_available() && r.resample == stbi__resample_row_h_2)
+                r.resample = resampleRowH2SSE2;
+#endif
+        }
+        return findSegments();
+    }
+
+    int width() const
+    {
+        return static_cast<int>(context.img_x);
+    }
+
+    int height() const
+    {
+        return static_cast<int>(context.img_y);
+    }
+
+    size_t segmentCount() const
+    {
+        return segments.size();
+    }
+
+    int componentCount() const
+    {
+        return context.img_n;
+    }
+
+    // Components holding R, G, B instead of Y, Cb, Cr
+    bool rgb() const
+    {
+        return isRGB;
+    }
+
+    Plane plane(int k) const
+    {
+        const auto &comp = jpeg->img_comp[k];
+        return {comp.w2, comp.h2, comp.y, resamplers[k].hs, resamplers[k].vs, resamplers[k].wLores, jpeg->dequant[comp.tq]};
+    }
+
+    // Number of coefficients written by decodeCoefficients()
+    size_t coefficientCount() const
+    {
+        size_t count = 0;
+        for (int k = 0; k < componentCount(); ++k)
+        {
+            count += static_cast<size_t>(jpeg->img_comp[k].w2) * jpeg->img_comp[k].h2;
+        }
+        return count;
+    }
+
+    // Entropy decode the parsed file into 'coefficients', without dequantization: the 64
+    // coefficients (natural order) of the blocks of plane(0), in raster order of the blocks,
+    // then those of plane(1)... Returns false on corrupt data.
+    bool decodeCoefficients(short *coefficients, ThreadPool *pool = nullptr)
+    {
+        return decodeAllSegments(coefficients, pool ? pool : &defaultThreadPool());
+    }
+
+    // Decode the width() x height() RGBA pixels of the parsed file into 'pixels'. On corrupt
+    // entropy-coded data, returns false before writing 'pixels'. 'pool' defaults to defaultThreadPool().
+    bool decode(uint8_t *pixels, ThreadPool *pool = nullptr)
+    {
+        pool = pool ? pool : &defaultThreadPool();
+
+        // Entropy decoding + IDCT into the component planes
+        if (!decodeAllSegments(nullptr, pool))
+        {
+            return false;
+        }
+
+        // Upsampling + color conversion
+        int rows = height();
+        int bandCount = std::min(rows, static_cast<int>(pool->size()) * 2);
+        std::vector<std::future<void>> converted;
+        for (int b = 0; b < bandCount; ++b)
+        {
+            int first = rows * b / bandCount;
+            int last = rows * (b + 1) / bandCount;
+            converted.push_back(pool->submit([=]() { convertRows(first, last, pixels); }));
+        }
+        for (auto &result : converted)
+        {
+            result.get();
+        }
+        return true;
+    }
+
+private:
+    struct Segment
+    {
+        const stbi_uc *data;
+        int size;
+        int firstMCU;
+        int mcuCount;
+    };
+
+    struct Resampler
+    {
+        resample_row_func resample = nullptr;
+        int hs = 1, vs = 1;
+        int wLores = 0;
+    };
+
+    // Split the entropy-coded data of the scan at its RSTn markers, each segment ending
+    // with the marker that closes it (the decoder stops reading there)
+    bool findSegments()
+    {
+        const stbi_uc *begin = context.img_buffer;
+        const stbi_uc *p = begin;
+        const stbi_uc *end = context.img_buffer_end;
+        int interval = jpeg->restart_interval > 0 ? jpeg->restart_interval : mcuCount;
+        int expected = (mcuCount + interval - 1) / interval;
+        int nextRestart = 0xd0;
+        int lastMarker = -1;
+        while (p + 1 < end)
+        {
+            if (p[0] != 0xff || p[1] == 0xff)
+            {
+                ++p; // Entropy-coded byte or fill byte
+                continue;
+            }
+            if (p[1] == 0x00)
+            {
+                p += 2; // Stuffed 0xff
+                continue;
+            }
+            lastMarker = p[1];
+            if (STBI__RESTART(lastMarker) && (lastMarker != nextRestart || jpeg->restart_interval <= 0))
+            {
+                return false; // Missing segment
+            }
+            int first = static_cast<int>(segments.size()) * interval;
+            segments.push_back({begin, static_cast<int>(p + 2 - begin), first, std::min(interval, mcuCount - first)});
+            if (!STBI__RESTART(lastMarker))
+            {
+                break;
+            }
+            nextRestart = 0xd0 + ((lastMarker - 0xd0 + 1) & 7);
+            p += 2;
+            begin = p;
+        }
+        // Some encoders close the last interval with a restart marker as well
+        if (static_cast<int>(segments.size()) == expected + 1 && segments.back().size == 2)
+        {
+            segments.pop_back();
+        }
+        // Anything but EOI after the scan (DNL, more scans...) is left to stb_image
+        return stbi__EOI(lastMarker) && static_cast<int>(segments.size()) == expected;
+    }
+
+    // Decode the segments on 'pool', into the planes or to 'coefficients' if not null
+    bool decodeAllSegments(short *coefficients, ThreadPool *pool) const
+    {
+        size_t taskCount = std::min(segments.size(), pool->size() * 4);
+        std::vector<std::future<bool>> decoded;
+        for (size_t t = 0; t < taskCount; ++t)
+        {
+            size_t first = segments.size() * t / taskCount;
+            size_t last = segments.size() * (t + 1) / taskCount;
+            decoded.push_back(pool->submit([=]() { return decodeSegments(first, last, coefficients); }));
+        }
+        bool ok = true;
+        for (auto &result : decoded)
+        {
+            ok = result.get() && ok;
+        }
+        return ok;
+    }
+
+    // Decode the segments [first, last) with a private copy of the decoder state
+    bool decodeSegments(size_t first, size_t last, short *coefficients) const
+    {
+        stbi__jpeg *z = static_cast<stbi__jpeg *>(malloc(sizeof(stbi__jpeg)));
+        if (!z)
+        {
+            return false;
+        }
+        memcpy(z, jpeg, sizeof(stbi__jpeg));
+        if (coefficients)
+        {
+            // Dequantized on the GPU
+            static const stbi__uint16 unitTable[64] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+            for (int t = 0; t < 4; ++t)
+            {
+                memcpy(z->dequant[t], unitTable, sizeof(unitTable));
+            }
+        }
+        stbi__context segmentContext;
+        STBI_SIMD_ALIGN(short, data[64]);
+        bool ok = true;
+        for (size_t s = first; ok && s < last; ++s)
+        {
+            const Segment &segment = segments[s];
+            stbi__start_mem(&segmentContext, segment.data, segment.size);
+            z->s = &segmentContext;
+            stbi__jpeg_reset(z);
+            for (int mcu = segment.firstMCU; ok && mcu < segment.firstMCU + segment.mcuCount; ++mcu)
+            {
+                ok = decodeMCU(z, mcu % mcuPerRow, mcu / mcuPerRow, data, coefficients);
+            }
+        }
+        free(z);
+        return ok;
+    }
+
+    // Same block order as stbi__parse_entropy_coded_data()
+    bool decodeMCU(stbi__jpeg *z, int i, int j, short *data, short *coefficients) const
+    {
+        if (z->scan_n == 1)
+        {
+            int n = z->order[0];
+            int ha = z->img_comp[n].ha;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq]))
+                return false;
+            storeBlock(z, n, i, j, data, coefficients);
+            return true;
+        }
+        for (int k = 0; k < z->scan_n; ++k)
+        {
+            int n = z->order[k];
+            for (int y = 0; y < z->img_comp[n].v; ++y)
+            {
+                for (int x = 0; x < z->img_comp[n].h; ++x)
+                {
+                    int ha = z->img_comp[n].ha;
+                    if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq]))
+                        return false;
+                    storeBlock(z, n, i * z->img_comp[n].h + x, j * z->img_comp[n].v + y, data, coefficients);
+                }
+            }
+        }
+        return true;
+    }
+
+    // IDCT of the block (x, y) of component n into its plane, or copy of its coefficients
+    void storeBlock(stbi__jpeg *z, int n, int x, int y, short *data, short *coefficients) const
+    {
+        const auto &comp = z->img_comp[n];
+        if (!coefficients)
+        {
+            z->idct_block_kernel(comp.data + comp.w2 * y * 8 + x * 8, comp.w2, data);
+            return;
+        }
+        size_t block = static_cast<size_t>(y) * (comp.w2 / 8) + x;
+        for (int k = 0; k < n; ++k)
+        {
+            block += static_cast<size_t>(z->img_comp[k].w2 / 8) * (z->img_comp[k].h2 / 8);
+        }
+        memcpy(coefficients + block * 64, data, 64 * sizeof(short));
+    }
+
+    // Output rows [first, last). The source rows of each output row are derived from its
+    // index instead of the running state of load_jpeg_image(), with the same result.
+    void convertRows(int first, int last, uint8_t *pixels) const
+    {
+        int n = context.img_n;
+        int w = width();
+        std::vector<stbi_uc> lineBuffers(static_cast<size_t>(n) * (w + 3));
+        stbi_uc *rows[3] = {nullptr, nullptr, nullptr};
+        for (int y = first; y < last; ++y)
+        {
+            for (int k = 0; k < n; ++k)
+            {
+                const Resampler &r = resamplers[k];
+                const auto &comp = jpeg->img_comp[k];
+                int half = r.vs >> 1;
+                int advanced = (half + y) / r.vs; // Source rows consumed before row y
+                int line1 = std::min(advanced, comp.y - 1);
+                int line0 = advanced == 0 ? 0 : std::min(advanced - 1, comp.y - 1);
+                bool bottom = (half + y) % r.vs >= half;
+                stbi_uc *nearRow = comp.data + comp.w2 * (bottom ? line1 : line0);
+                stbi_uc *farRow = comp.data + comp.w2 * (bottom ? line0 : line1);
+                rows[k] = r.resample(&lineBuffers[static_cast<size_t>(k) * (w + 3)], nearRow, farRow, r.wLores, r.hs);
+            }
+            stbi_uc *out = pixels + static_cast<size_t>(w) * 4 * y;
+            if (n == 3 && !isRGB)
+            {
+                jpeg->YCbCr_to_RGB_kernel(out, rows[0], rows[1], rows[2], w, 4);
+            }
+            else if (n == 3)
+            {
+                for (int i = 0; i < w; ++i, out += 4)
+                {
+                    out[0] = rows[0][i];
+                    out[1] = rows[1][i];
+                    out[2] = rows[2][i];
+                    out[3] = 255;
+                }
+            }
+            else
+            {
+                for (int i = 0; i < w; ++i, out += 4)
+                {
+                    out[0] = out[1] = out[2] = rows[0][i];
+                    out[3] = 255;
+                }
+            }
+        }
+    }
+
+    stbi__context context;
+    stbi__jpeg *jpeg = nullptr;
+    std::vector<Segment> segments;
+    Resampler resamplers[3];
+    int mcuPerRow = 0;
+    int mcuCount = 0;
+    bool isRGB = false;
+};
@@ -0,0 +1,169 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Hybrid JPEG decoder: the CPU only does the entropy decoding (see ParallelJpegDecoder::
+// decodeCoefficients(), in parallel when the file has restart markers), straight into the
+// upload staging memory. The quantized coefficients are copied to an SSBO and the
+// jpeg_decode.comp kernels run the arithmetic of the decoder on the GPU:
+//  - dequantization + IDCT of every component into 8-bit planes (SSBO),
+//  - upsampling + YCbCr to RGBA conversion into the RGBA8UI input texture.
+// The pixels are identical to stbi_load(). The upload is 2 bytes per plane sample,
+// i.e. 3 bytes per pixel for 4:2:0 files instead of 4 for the decoded pixels.
+//
+//   GpuJpegDecoder decoder;
+//   GLuint tex = decoder.load("photo.jpg", uploads, textures, w, h);
+//   if (!tex)
+//       tex = loadTexture("photo.jpg", uploads, textures, w, h);
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "gl_helper.h"
+#include "image_loader.h"
+
+class GpuJpegDecoder
+{
+public:
+    GpuJpegDecoder()
+    {
+        idctProgram = createComputeShader("jpeg_decode.comp", {{"KERNEL_IDCT", "1"}});
+        colorProgram = createComputeShader("jpeg_decode.comp", {{"KERNEL_COLOR", "1"}});
+        idctUniforms.quant = glGetUniformLocation(idctProgram, "quant");
+        idctUniforms.blockCount = glGetUniformLocation(idctProgram, "blockCount");
+        idctUniforms.coeffOffset = glGetUniformLocation(idctProgram, "coeffOffset");
+        idctUniforms.planeOffset = glGetUniformLocation(idctProgram, "planeOffset");
+        idctUniforms.stride = glGetUniformLocation(idctProgram, "stride");
+        colorUniforms.size = glGetUniformLocation(colorProgram, "size");
+        colorUniforms.componentCount = glGetUniformLocation(colorProgram, "componentCount");
+        colorUniforms.rgb = glGetUniformLocation(colorProgram, "rgb");
+        colorUniforms.planeInfo = glGetUniformLocation(colorProgram, "planeInfo");
+        colorUniforms.factors = glGetUniformLocation(colorProgram, "factors");
+    }
+
+    ~GpuJpegDecoder()
+    {
+        glState().deleteBuffers(1, &coefficientBuffer);
+        glState().deleteBuffers(1, &planeBuffer);
+        glState().deleteProgram(idctProgram);
+        glState().deleteProgram(colorProgram);
+    }
+
+    GpuJpegDecoder(const GpuJpegDecoder &) = delete;
+    GpuJpegDecoder &operator=(const GpuJpegDecoder &) = delete;
+
+    // Decode 'filename' into a RGBA8UI texture taken from 'textures'. Returns 0 if the file
+    // is not a baseline JPEG with a single scan of 1 or 3 components, or is corrupt.
+    GLuint load(const std::string &filename, UploadRing &uploads, TexturePool &textures, int &w, int &h)
+    {
+        std::vector<uint8_t> content;
+        ParallelJpegDecoder jpeg;
+        if (!readBinaryFile(filename, content) || !jpeg.parse(content.data(), content.size(), false))
+        {
+            return 0;
+        }
+
+        // Entropy decoding into the staging memory
+        size_t coefficientSize = jpeg.coefficientCount() * sizeof(short);
+        UploadRing::Allocation staging = uploads.allocate(coefficientSize);
+        if (!jpeg.decodeCoefficients(reinterpret_cast<short *>(staging.data)))
+        {
+            uploads.discard(staging);
+            return 0;
+        }
+        size_t planeSize = jpeg.coefficientCount(); // One byte per coefficient
+        reserve(coefficientBuffer, coefficientCapacity, coefficientSize);
+        reserve(planeBuffer, planeCapacity, planeSize);
+        uploads.uploadBuffer(staging, coefficientSize, coefficientBuffer);
+
+        GLStateCache &state = glState();
+        MemoryBarrierTracker &barriers = glBarriers();
+        barriers.bufferAccess(coefficientBuffer, GL_SHADER_STORAGE_BARRIER_BIT);
+        barriers.bufferAccess(planeBuffer, GL_SHADER_STORAGE_BARRIER_BIT);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, coefficientBuffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, planeBuffer);
+
+        // Dequantization + IDCT, one dispatch per component
+        state.useProgram(idctProgram);
+        GLint planeInfo[3 * 4] = {};
+        GLint factors[3 * 2] = {};
+        int offset = 0; // In plane samples, i.e. coefficients
+        for (int k = 0; k < jpeg.componentCount(); ++k)
+        {
+            ParallelJpegDecoder::Plane plane = jpeg.plane(k);
+            GLint quant[64];
+            for (int i = 0; i < 64; ++i)
+            {
+                quant[i] = plane.dequant[i];
+            }
+            glProgramUniform1iv(idctProgram, idctUniforms.quant, 64, quant);
+            glProgramUniform2i(idctProgram, idctUniforms.blockCount, plane.stride / 8, plane.rows / 8);
+            glProgramUniform1i(idctProgram, idctUniforms.coeffOffset, offset / 2);
+            glProgramUniform1i(idctProgram, idctUniforms.planeOffset, offset / 4);
+            glProgramUniform1i(idctProgram, idctUniforms.stride, plane.stride);
+            glDispatchCompute((plane.stride / 8 + 7) / 8, plane.rows / 8, 1);
+
+            GLint info[4] = {offset / 4, plane.stride, plane.height, plane.wLores};
+            std::copy(info, info + 4, planeInfo + 4 * k);
+            factors[2 * k] = plane.hs;
+            factors[2 * k + 1] = plane.vs;
+            offset += plane.stride * plane.rows;
+        }
+        barriers.bufferWritten(planeBuffer);
+
+        // Upsampling + color conversion into the texture
+        w = jpeg.width();
+        h = jpeg.height();
+        GLuint tex = textures.acquire(GL_RGBA8UI, w, h);
+        state.useProgram(colorProgram);
+        glProgramUniform2i(colorProgram, colorUniforms.size, w, h);
+        glProgramUniform1i(colorProgram, colorUniforms.componentCount, jpeg.componentCount());
+        glProgramUniform1i(colorProgram, colorUniforms.rgb, jpeg.rgb() ? 1 : 0);
+        glProgramUniform4iv(colorProgram, colorUniforms.planeInfo, 3, planeInfo);
+        glProgramUniform2iv(colorProgram, colorUniforms.factors, 3, factors);
+        barriers.bufferAccess(planeBuffer, GL_SHADER_STORAGE_BARRIER_BIT);
+        barriers.textureAccess(tex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        state.bindImageTexture(0, tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+        glDispatchCompute((w + 15) / 16, (h + 15) / 16, 1);
+        barriers.imageWritten(tex);
+        return tex;
+    }
+
+private:
+    // Grow 'buffer' to hold at least 'size' bytes (previous content is lost)
+    static void reserve(GLuint &buffer, size_t &capacity, size_t size)
+    {
+        if (buffer && capacity >= size)
+        {
+            return;
+        }
+        glState().deleteBuffers(1, &buffer);
+        buffer = createBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr, 0);
+        capacity = size;
+    }
+
+    GLuint idctProgram = 0;
+    GLuint colorProgram = 0;
+    struct
+    {
+        GLint quant, blockCount, coeffOffset, planeOffset, stride;
+    } idctUniforms;
+    struct
+    {
+        GLint size, componentCount, rgb, planeInfo, factors;
+    } colorUniforms;
+    GLuint coefficientBuffer = 0;
+    GLuint planeBuffer = 0;
+    size_t coefficientCapacity = 0;
+    size_t planeCapacity = 0;
+};
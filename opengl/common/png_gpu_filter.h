@@ -0,0 +1,133 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// PNG output whose row filtering runs on the GPU: the png_filter.comp kernels pick the
+// filter of every row of the texture region (same heuristic as filterPNGRow()) and write
+// the filtered rows to an SSBO, which is read back instead of the pixels. The CPU then
+// only deflates the bands (writePNGPrefiltered()), and the file is identical to the one
+// of saveTextureRegion().
+//
+//   GpuPNGFilter pngFilter;
+//   pngFilter.saveTextureRegion(outTex, 0, 0, w, h, "out.png", pngLevel);
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "gl_helper.h"
+#include "image_writer.h"
+
+class GpuPNGFilter
+{
+public:
+    GpuPNGFilter()
+    {
+        selectProgram = createComputeShader("png_filter.comp", {{"KERNEL_SELECT", "1"}});
+        packProgram = createComputeShader("png_filter.comp", {{"KERNEL_PACK", "1"}});
+        selectUniforms.origin = glGetUniformLocation(selectProgram, "origin");
+        selectUniforms.size = glGetUniformLocation(selectProgram, "size");
+        packUniforms.origin = glGetUniformLocation(packProgram, "origin");
+        packUniforms.size = glGetUniformLocation(packProgram, "size");
+        packUniforms.wordCount = glGetUniformLocation(packProgram, "wordCount");
+    }
+
+    ~GpuPNGFilter()
+    {
+        glState().deleteBuffers(1, &typeBuffer);
+        glState().deleteBuffers(1, &filteredBuffer);
+        glState().deleteProgram(selectProgram);
+        glState().deleteProgram(packProgram);
+    }
+
+    GpuPNGFilter(const GpuPNGFilter &) = delete;
+    GpuPNGFilter &operator=(const GpuPNGFilter &) = delete;
+
+    // Filter the w x h region starting at (x, y) of the RGBA8UI texture 'tex' and read back
+    // the h filtered rows (1 filter type byte + w * 4 bytes each) into 'filtered'
+    void filterTextureRegion(GLuint tex, int x, int y, int w, int h, std::vector<uint8_t> &filtered)
+    {
+        size_t filteredSize = (static_cast<size_t>(w) * 4 + 1) * h;
+        size_t wordCount = (filteredSize + 3) / 4;
+        reserve(typeBuffer, typeCapacity, static_cast<size_t>(h) * sizeof(GLuint));
+        reserve(filteredBuffer, filteredCapacity, wordCount * sizeof(GLuint));
+
+        GLStateCache &state = glState();
+        MemoryBarrierTracker &barriers = glBarriers();
+        barriers.textureAccess(tex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        state.bindImageTexture(0, tex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+        barriers.bufferAccess(typeBuffer, GL_SHADER_STORAGE_BARRIER_BIT);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, typeBuffer);
+
+        // Filter type of each row, one group per row
+        state.useProgram(selectProgram);
+        glProgramUniform2i(selectProgram, selectUniforms.origin, x, y);
+        glProgramUniform2i(selectProgram, selectUniforms.size, w, h);
+        glDispatchCompute(h, 1, 1);
+        barriers.bufferWritten(typeBuffer);
+
+        // Filtered rows, packed as the PNG stream expects them
+        barriers.bufferAccess(typeBuffer, GL_SHADER_STORAGE_BARRIER_BIT);
+        barriers.bufferAccess(filteredBuffer, GL_SHADER_STORAGE_BARRIER_BIT);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, filteredBuffer);
+        state.useProgram(packProgram);
+        glProgramUniform2i(packProgram, packUniforms.origin, x, y);
+        glProgramUniform2i(packProgram, packUniforms.size, w, h);
+        glProgramUniform1ui(packProgram, packUniforms.wordCount, static_cast<GLuint>(wordCount));
+        glDispatchCompute(static_cast<GLuint>(std::min<size_t>((wordCount + 255) / 256, 65535)), 1, 1);
+        barriers.bufferWritten(filteredBuffer);
+
+        filtered.resize(wordCount * 4);
+        getBufferData(GL_SHADER_STORAGE_BUFFER, filteredBuffer, 0, filtered.size(), filtered.data());
+        filtered.resize(filteredSize);
+    }
+
+    // Same as saveTextureRegion() of image_writer.h, PNG files being filtered on the GPU
+    bool saveTextureRegion(GLuint tex, int x, int y, int w, int h, const std::string &filename, int pngLevel = 6)
+    {
+        if (imageFormatFromFilename(filename) != ImageFormat::PNG)
+        {
+            return ::saveTextureRegion(tex, x, y, w, h, filename, pngLevel);
+        }
+        std::vector<uint8_t> filtered;
+        filterTextureRegion(tex, x, y, w, h, filtered);
+        return writePNGPrefiltered(filename, w, h, 4, filtered.data(), pngLevel);
+    }
+
+private:
+    // Grow 'buffer' to hold at least 'size' bytes (previous content is lost)
+    static void reserve(GLuint &buffer, size_t &capacity, size_t size)
+    {
+        if (buffer && capacity >= size)
+        {
+            return;
+        }
+        glState().deleteBuffers(1, &buffer);
+        buffer = createBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr, 0);
+        capacity = size;
+    }
+
+    GLuint selectProgram = 0;
+    GLuint packProgram = 0;
+    struct
+    {
+        GLint origin, size;
+    } selectUniforms;
+    struct
+    {
+        GLint origin, size, wordCount;
+    } packUniforms;
+    GLuint typeBuffer = 0;
+    GLuint filteredBuffer = 0;
+    size_t typeCapacity = 0;
+    size_t filteredCapacity = 0;
+};
@@ -0,0 +1,435 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Parallel PNG encoder: the image is split in bands of rows that are filtered and
+// deflated independently on a thread pool. Every band but the last one ends with a
+// zlib sync flush (byte aligned, non final block), so the compressed bands can simply
+// be concatenated into a single valid zlib stream, each band becoming one IDAT chunk.
+// As in pigz, each band is primed with the last 32 KB of the previous band's data
+// so that splitting barely costs any compression ratio.
+// writePNGPrefiltered() takes rows already filtered elsewhere (e.g. on the GPU, see
+// png_gpu_filter.h), the bands are then only deflated. PNGStreamWriter takes the rows
+// a few at a time, for images that are never in memory at once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <utility>
+#include <zlib.h>
+
+#include "thread_pool.h"
+
+enum PNGFilter
+{
+    PNGFilterNone = 0,
+    PNGFilterSub = 1,
+    PNGFilterUp = 2,
+    PNGFilterAverage = 3,
+    PNGFilterPaeth = 4
+};
+
+static uint8_t paethPredictor(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return static_cast<uint8_t>(a);
+    if (pb <= pc)
+        return static_cast<uint8_t>(b);
+    return static_cast<uint8_t>(c);
+}
+
+// Apply 'filter' to 'row' ('prev' is nullptr for the first row of the image)
+void applyPNGFilter(int filter, const uint8_t *row, const uint8_t *prev, int rowBytes, int bpp, uint8_t *out)
+{
+    for (int i = 0; i < rowBytes; ++i)
+    {
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+        switch (filter)
+        {
+        case PNGFilterSub:
+            out[i] = static_cast<uint8_t>(row[i] - a);
+            break;
+        case PNGFilterUp:
+            out[i] = static_cast<uint8_t>(row[i] - b);
+            break;
+        case PNGFilterAverage:
+            out[i] = static_cast<uint8_t>(row[i] - ((a + b) >> 1));
+            break;
+        case PNGFilterPaeth:
+            out[i] = static_cast<uint8_t>(row[i] - paethPredictor(a, b, c));
+            break;
+        default:
+            out[i] = row[i];
+            break;
+        }
+    }
+}
+
+// Filter one row into 'out' (1 filter type byte + rowBytes), picking the filter
+// with the minimum sum of absolute differences as libpng does
+void filterPNGRow(const uint8_t *row, const uint8_t *prev, int rowBytes, int bpp, uint8_t *out, std::vector<uint8_t> &scratch)
+{
+    scratch.resize(rowBytes);
+    long bestSum = -1;
+    for (int filter = PNGFilterNone; filter <= PNGFilterPaeth; ++filter)
+    {
+        applyPNGFilter(filter, row, prev, rowBytes, bpp, scratch.data());
+        long sum = 0;
+        for (int i = 0; i < rowBytes; ++i)
+        {
+            sum += abs(static_cast<int8_t>(scratch[i]));
+        }
+        if (bestSum < 0 || sum < bestSum)
+        {
+            bestSum = sum;
+            out[0] = static_cast<uint8_t>(filter);
+            memcpy(out + 1, scratch.data(), rowBytes);
+        }
+    }
+}
+
+// Deflate one band of already filtered rows as a raw deflate stream.
+// 'dictionary' holds the filtered data preceding the band (up to 32 KB).
+bool deflatePNGBand(const uint8_t *filtered, size_t size, const uint8_t *dictionary, size_t dictionarySize,
+                    bool last, int compressionLevel, std::vector<uint8_t> &out)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, compressionLevel, Z_DEFLATED, -15 /* raw deflate */, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+    if (dictionarySize > 0)
+    {
+        deflateSetDictionary(&stream, dictionary, static_cast<uInt>(dictionarySize));
+    }
+    out.resize(deflateBound(&stream, static_cast<uLong>(size)) + 16);
+    stream.next_in = const_cast<Bytef *>(filtered);
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = out.data();
+    stream.avail_out = static_cast<uInt>(out.size());
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = last ? result == Z_STREAM_END : result == Z_OK;
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return ok;
+}
+
+struct PNGBand
+{
+    std::vector<uint8_t> compressed;
+    uLong adler = 0;
+    size_t filteredSize = 0;
+    bool ok = false;
+};
+
+static void writePNGUint32(std::vector<uint8_t> &out, uint32_t v)
+{
+    out.push_back(static_cast<uint8_t>(v >> 24));
+    out.push_back(static_cast<uint8_t>(v >> 16));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Write a chunk whose data is the concatenation of 'parts' (pointer, size)
+static bool writePNGChunk(FILE *f, const char *type, const std::vector<std::pair<const uint8_t *, size_t>> &parts)
+{
+    size_t size = 0;
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef *>(type), 4);
+    for (auto &part : parts)
+    {
+        size += part.second;
+        crc = crc32(crc, part.first, static_cast<uInt>(part.second));
+    }
+    std::vector<uint8_t> header;
+    writePNGUint32(header, static_cast<uint32_t>(size));
+    header.insert(header.end(), type, type + 4);
+    bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+    for (auto &part : parts)
+    {
+        ok = ok && fwrite(part.first, 1, part.second, f) == part.second;
+    }
+    std::vector<uint8_t> footer;
+    writePNGUint32(footer, static_cast<uint32_t>(crc));
+    return ok && fwrite(footer.data(), 1, footer.size(), f) == footer.size();
+}
+
+// Filtered rows [firstRow, lastRow) of the image, contiguous ('storage' may hold them)
+typedef std::function<const uint8_t *(int firstRow, int lastRow, std::vector<uint8_t> &storage)> PNGRowFilter;
+
+// Signature and IHDR chunk
+static bool writePNGHeader(FILE *f, int w, int h, int numChannels)
+{
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    bool ok = fwrite(signature, 1, sizeof(signature), f) == sizeof(signature);
+    std::vector<uint8_t> ihdr;
+    writePNGUint32(ihdr, static_cast<uint32_t>(w));
+    writePNGUint32(ihdr, static_cast<uint32_t>(h));
+    static const uint8_t colorTypes[5] = {0, 0 /* gray */, 4 /* gray + alpha */, 2 /* RGB */, 6 /* RGBA */};
+    uint8_t ihdrTail[5] = {8 /* bit depth */, colorTypes[numChannels], 0, 0, 0};
+    ihdr.insert(ihdr.end(), ihdrTail, ihdrTail + 5);
+    return ok && writePNGChunk(f, "IHDR", {{ihdr.data(), ihdr.size()}});
+}
+
+// Rows of filtered data a band is primed with (at most 32 KB)
+static int pngDictionaryRows(size_t filteredRowBytes)
+{
+    return static_cast<int>((32768 + filteredRowBytes - 1) / filteredRowBytes);
+}
+
+// Deflate the filtered rows [firstRow, lastRow) given by 'filterRows' in bands on 'pool' and
+// write them as IDAT chunks. The zlib header goes before row 0, the Adler-32 of the whole
+// stream ('adler', updated) after row h - 1. 'filterRows' may be asked for the rows of the
+// dictionary before 'firstRow'.
+static bool writePNGIDATBands(FILE *f, int w, int h, int numChannels, int firstRow, int lastRow, int compressionLevel,
+                              ThreadPool *pool, const PNGRowFilter &filterRows, uLong &adler)
+{
+    size_t filteredRowBytes = static_cast<size_t>(w) * numChannels + 1;
+    int rows = lastRow - firstRow;
+
+    // Around 4 bands per thread for load balancing, but bands of at least 256 KB
+    int minRowsPerBand = static_cast<int>(std::max<size_t>(1, (256 * 1024) / filteredRowBytes));
+    int bandCount = std::max(1, std::min(static_cast<int>(pool->size()) * 4, rows / minRowsPerBand));
+    int rowsPerBand = (rows + bandCount - 1) / bandCount;
+    bandCount = (rows + rowsPerBand - 1) / rowsPerBand;
+    int dictionaryRows = pngDictionaryRows(filteredRowBytes);
+
+    std::vector<std::future<PNGBand>> futures;
+    for (int band = 0; band < bandCount; ++band)
+    {
+        futures.push_back(pool->submit([=, &filterRows]() {
+            PNGBand result;
+            int bandFirstRow = firstRow + band * rowsPerBand;
+            int bandLastRow = std::min(lastRow, bandFirstRow + rowsPerBand);
+            int dictionaryFirstRow = std::max(0, bandFirstRow - dictionaryRows);
+            std::vector<uint8_t> storage;
+            const uint8_t *filtered = filterRows(dictionaryFirstRow, bandLastRow, storage);
+            size_t dictionaryBytes = (bandFirstRow - dictionaryFirstRow) * filteredRowBytes;
+            size_t dictionarySize = std::min<size_t>(dictionaryBytes, 32768);
+            const uint8_t *bandData = filtered + dictionaryBytes;
+            result.filteredSize = (bandLastRow - bandFirstRow) * filteredRowBytes;
+            result.adler = adler32(adler32(0L, Z_NULL, 0), bandData, static_cast<uInt>(result.filteredSize));
+            result.ok = deflatePNGBand(bandData, result.filteredSize, bandData - dictionarySize, dictionarySize,
+                                       bandLastRow == h, compressionLevel, result.compressed);
+            return result;
+        }));
+    }
+
+    // One IDAT per band written in order as soon as it is ready
+    uint8_t flevel = compressionLevel < 2 ? 0 : (compressionLevel < 6 ? 1 : (compressionLevel == 6 ? 2 : 3));
+    uint8_t zlibHeader[2] = {0x78, static_cast<uint8_t>(flevel << 6)};
+    zlibHeader[1] += static_cast<uint8_t>(31 - ((zlibHeader[0] << 8) | zlibHeader[1]) % 31);
+    bool ok = true;
+    for (int band = 0; band < bandCount; ++band)
+    {
+        PNGBand result = futures[band].get();
+        ok = ok && result.ok;
+        adler = adler32_combine(adler, result.adler, static_cast<z_off_t>(result.filteredSize));
+        std::vector<std::pair<const uint8_t *, size_t>> parts;
+        if (firstRow == 0 && band == 0)
+            parts.emplace_back(zlibHeader, sizeof(zlibHeader));
+        parts.emplace_back(result.compressed.data(), result.compressed.size());
+        std::vector<uint8_t> adlerBytes;
+        if (lastRow == h && band == bandCount - 1)
+        {
+            writePNGUint32(adlerBytes, static_cast<uint32_t>(adler));
+            parts.emplace_back(adlerBytes.data(), adlerBytes.size());
+        }
+        ok = ok && writePNGChunk(f, "IDAT", parts);
+    }
+    return ok;
+}
+
+// Deflate the filtered rows given by 'filterRows' in bands on 'pool' and write the PNG file
+static bool writePNGBands(const std::string &filename, int w, int h, int numChannels, int compressionLevel,
+                          ThreadPool *pool, const PNGRowFilter &filterRows)
+{
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (!f)
+    {
+        return false;
+    }
+    pool = pool ? pool : &defaultThreadPool();
+    compressionLevel = std::max(0, std::min(9, compressionLevel));
+    uLong adler = adler32(0L, Z_NULL, 0);
+    bool ok = writePNGHeader(f, w, h, numChannels);
+    ok = ok && writePNGIDATBands(f, w, h, numChannels, 0, h, compressionLevel, pool, filterRows, adler);
+    ok = ok && writePNGChunk(f, "IEND", {});
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+// Filter rows [firstRow, lastRow) into 'filtered', 'rowAt(y)' giving the source rows
+template <typename RowAt>
+static void filterPNGRows(int firstRow, int lastRow, int rowBytes, int numChannels, const RowAt &rowAt,
+                          std::vector<uint8_t> &filtered)
+{
+    size_t filteredRowBytes = static_cast<size_t>(rowBytes) + 1;
+    filtered.resize((lastRow - firstRow) * filteredRowBytes);
+    std::vector<uint8_t> scratch;
+    for (int y = firstRow; y < lastRow; ++y)
+    {
+        filterPNGRow(rowAt(y), y > 0 ? rowAt(y - 1) : nullptr, rowBytes, numChannels,
+                     filtered.data() + (y - firstRow) * filteredRowBytes, scratch);
+    }
+}
+
+// Write an 8-bit PNG with 1 to 4 channels. 'compressionLevel' is the zlib level
+// (0 = store, 1 = fastest, 9 = smallest), 'pool' defaults to defaultThreadPool().
+bool writePNGParallel(const std::string &filename, int w, int h, int numChannels, const uint8_t *data,
+                      int strideInBytes, int compressionLevel = 6, ThreadPool *pool = nullptr)
+{
+    if (w <= 0 || h <= 0 || numChannels < 1 || numChannels > 4)
+    {
+        return false;
+    }
+    int rowBytes = w * numChannels;
+    auto rowAt = [=](int y) { return data + static_cast<size_t>(y) * strideInBytes; };
+    // Filtering a row only depends on the source rows, so the rows of the previous
+    // band used as dictionary are filtered again by each band
+    return writePNGBands(filename, w, h, numChannels, compressionLevel, pool,
+                         [=](int firstRow, int lastRow, std::vector<uint8_t> &filtered) {
+                             filterPNGRows(firstRow, lastRow, rowBytes, numChannels, rowAt, filtered);
+                             return static_cast<const uint8_t *>(filtered.data());
+                         });
+}
+
+// Write an 8-bit PNG with 1 to 4 channels from rows already filtered: 'filtered' holds
+// h rows of 1 filter type byte + w * numChannels bytes, the bands are only deflated.
+bool writePNGPrefiltered(const std::string &filename, int w, int h, int numChannels, const uint8_t *filtered,
+                         int compressionLevel = 6, ThreadPool *pool = nullptr)
+{
+    if (w <= 0 || h <= 0 || numChannels < 1 || numChannels > 4)
+    {
+        return false;
+    }
+    size_t filteredRowBytes = static_cast<size_t>(w) * numChannels + 1;
+    return writePNGBands(filename, w, h, numChannels, compressionLevel, pool,
+                         [=](int firstRow, int, std::vector<uint8_t> &) { return filtered + firstRow * filteredRowBytes; });
+}
+
+// PNG written progressively: the rows are given in order, a few at a time (e.g. the strips
+// of an image too large to be generated at once), and each call filters and deflates them
+// in bands as writePNGParallel() does. Only the rows priming the next bands are kept.
+//
+//   PNGStreamWriter png;
+//   png.open("big.png", w, h, 4);
+//   png.writeRows(strip, stripHeight, w * 4); // For every strip, top to bottom
+//   png.close();
+class PNGStreamWriter
+{
+public:
+    PNGStreamWriter() = default;
+    PNGStreamWriter(const PNGStreamWriter &) = delete;
+    PNGStreamWriter &operator=(const PNGStreamWriter &) = delete;
+
+    ~PNGStreamWriter()
+    {
+        if (file)
+            fclose(file);
+    }
+
+    // Write the header of a w x h image with 1 to 4 channels
+    bool open(const std::string &filename, int width, int height, int channels, int compressionLevel = 6,
+              ThreadPool *threadPool = nullptr)
+    {
+        if (width <= 0 || height <= 0 || channels < 1 || channels > 4)
+        {
+            return false;
+        }
+        file = fopen(filename.c_str(), "wb");
+        if (!file)
+        {
+            return false;
+        }
+        w = width;
+        h = height;
+        numChannels = channels;
+        level = std::max(0, std::min(9, compressionLevel));
+        pool = threadPool ? threadPool : &defaultThreadPool();
+        nextRow = 0;
+        adler = adler32(0L, Z_NULL, 0);
+        previousRows.clear();
+        ok = writePNGHeader(file, w, h, numChannels);
+        return ok;
+    }
+
+    // Append the next 'rows' rows of the image
+    bool writeRows(const uint8_t *data, int rows, int strideInBytes)
+    {
+        rows = std::min(rows, h - nextRow);
+        if (!file || rows <= 0)
+        {
+            return false;
+        }
+        int rowBytes = w * numChannels;
+        int firstRow = nextRow;
+        int previousFirstRow = firstRow - static_cast<int>(previousRows.size() / rowBytes);
+        const uint8_t *previous = previousRows.data();
+        // Rows before 'firstRow' (dictionary and row above) come from the previous call
+        auto rowAt = [=](int y) {
+            return y >= firstRow ? data + static_cast<size_t>(y - firstRow) * strideInBytes
+                                 : previous + static_cast<size_t>(y - previousFirstRow) * rowBytes;
+        };
+        ok = ok && writePNGIDATBands(file, w, h, numChannels, firstRow, firstRow + rows, level, pool,
+                                     [=](int first, int last, std::vector<uint8_t> &filtered) {
+                                         filterPNGRows(first, last, rowBytes, numChannels, rowAt, filtered);
+                                         return static_cast<const uint8_t *>(filtered.data());
+                                     },
+                                     adler);
+        nextRow += rows;
+
+        // Keep the dictionary rows of the next call and the row above them
+        int keptRows = std::min(nextRow, pngDictionaryRows(static_cast<size_t>(rowBytes) + 1) + 1);
+        std::vector<uint8_t> kept(static_cast<size_t>(keptRows) * rowBytes);
+        for (int y = nextRow - keptRows; y < nextRow; ++y)
+        {
+            memcpy(kept.data() + static_cast<size_t>(y - (nextRow - keptRows)) * rowBytes, rowAt(y), rowBytes);
+        }
+        previousRows.swap(kept);
+        return ok;
+    }
+
+    // Write the end of the file, every row must have been written
+    bool close()
+    {
+        if (!file)
+        {
+            return false;
+        }
+        ok = ok && nextRow == h && writePNGChunk(file, "IEND", {});
+        ok = (fclose(file) == 0) && ok;
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    FILE *file = nullptr;
+    int w = 0;
+    int h = 0;
+    int numChannels = 0;
+    int level = 6;
+    ThreadPool *pool = nullptr;
+    int nextRow = 0;
+    uLong adler = 0;
+    std::vector<uint8_t> previousRows; // Last rows written, contiguous
+    bool ok = false;
+};
@@ -0,0 +1,247 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Asynchronous readbacks through a ring of GL_PIXEL_PACK_BUFFERs: a read only queues
+// the copy into the next free buffer and returns a handle signaled by a fence, so that
+// the GPU keeps working on the next images while the previous ones are transferred.
+// Buffers are persistently mapped when GL 4.4 / ARB_buffer_storage is available.
+//
+//   ReadbackRing ring(3);
+//   ReadbackRing::Handle readback = ring.readTexture(outTex, w, h); // Or readTextureRegion()
+//   ... dispatch the next image ...
+//   const uint8_t *pixels = readback.wait(); // Blocks only if the copy is not done yet
+//   ...
+//   readback.release();                     // The buffer can be reused
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "gl_resources.h"
+#include "gl_state.h"
+
+class ReadbackRing
+{
+    struct Slot
+    {
+        GLuint buffer = 0;
+        size_t capacity = 0;
+        size_t size = 0;
+        uint8_t *mapped = nullptr;
+        GLsync fence = nullptr;
+        bool busy = false;
+    };
+
+public:
+    // Result of one readback, valid until release()
+    class Handle
+    {
+    public:
+        Handle() = default;
+
+        bool valid() const
+        {
+            return slot != nullptr;
+        }
+
+        // Non blocking: true once the data has been copied
+        bool ready() const
+        {
+            if (!slot || !slot->fence)
+            {
+                return slot != nullptr;
+            }
+            GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+        }
+
+        // Wait for the copy and return the data (nullptr on failure)
+        const uint8_t *wait()
+        {
+            if (!slot)
+            {
+                return nullptr;
+            }
+            if (slot->fence)
+            {
+                GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(slot->fence);
+                slot->fence = nullptr;
+                if (status == GL_WAIT_FAILED)
+                {
+                    return nullptr;
+                }
+            }
+            if (!slot->mapped)
+            {
+                slot->mapped = static_cast<uint8_t *>(mapBufferRange(GL_PIXEL_PACK_BUFFER, slot->buffer, 0, slot->size, GL_MAP_READ_BIT));
+                glState().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                mappedHere = true;
+            }
+            return slot->mapped;
+        }
+
+        size_t size() const
+        {
+            return slot ? slot->size : 0;
+        }
+
+        // Give the buffer back to the ring
+        void release()
+        {
+            if (!slot)
+            {
+                return;
+            }
+            if (slot->fence)
+            {
+                glDeleteSync(slot->fence);
+                slot->fence = nullptr;
+            }
+            if (mappedHere)
+            {
+                unmapBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+                glState().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                slot->mapped = nullptr;
+                mappedHere = false;
+            }
+            slot->busy = false;
+            slot = nullptr;
+        }
+
+    private:
+        friend class ReadbackRing;
+        Slot *slot = nullptr;
+        bool mappedHere = false;
+    };
+
+    // 'slotCount' readbacks can be in flight before the ring grows
+    explicit ReadbackRing(size_t slotCount = 3) : persistent(gl3wIsSupported(4, 4) != 0)
+    {
+        for (size_t i = 0; i < slotCount; ++i)
+        {
+            slots.emplace_back(new Slot());
+        }
+    }
+
+    ~ReadbackRing()
+    {
+        destroy();
+    }
+
+    // Delete the buffers (e.g. before the context is destroyed), every handle must be released
+    void destroy()
+    {
+        for (auto &slot : slots)
+        {
+            if (slot->fence)
+                glDeleteSync(slot->fence);
+            if (slot->buffer)
+                glState().deleteBuffers(1, &slot->buffer);
+            *slot = Slot();
+        }
+    }
+
+    ReadbackRing(const ReadbackRing &) = delete;
+    ReadbackRing &operator=(const ReadbackRing &) = delete;
+
+    // Queue the readback of the level 0 of a w x h RGBA8UI texture
+    Handle readTexture(GLuint tex, int w, int h)
+    {
+        Handle handle;
+        handle.slot = acquire(static_cast<size_t>(w) * h * 4);
+        getTextureImage(tex, GL_RGBA_INTEGER, handle.slot->size, nullptr);
+        submit(*handle.slot);
+        return handle;
+    }
+
+    // Queue the readback of the w x h region of a RGBA8UI texture starting at (x, y)
+    Handle readTextureRegion(GLuint tex, int x, int y, int w, int h)
+    {
+        Handle handle;
+        handle.slot = acquire(static_cast<size_t>(w) * h * 4);
+        getTextureRegion(tex, x, y, w, h, GL_RGBA_INTEGER, handle.slot->size, nullptr);
+        submit(*handle.slot);
+        return handle;
+    }
+
+    // Queue the readback of 'size' bytes of 'buffer' (SSBO...) from 'offset'
+    Handle readBuffer(GLuint buffer, size_t offset, size_t size)
+    {
+        Handle handle;
+        handle.slot = acquire(size);
+        copyBufferData(buffer, handle.slot->buffer, offset, 0, size);
+        submit(*handle.slot);
+        return handle;
+    }
+
+    size_t slotCount() const
+    {
+        return slots.size();
+    }
+
+private:
+    // Next free slot in ring order, bound to GL_PIXEL_PACK_BUFFER with at least 'size' bytes
+    Slot *acquire(size_t size)
+    {
+        Slot *slot = nullptr;
+        for (size_t i = 0; i < slots.size() && !slot; ++i)
+        {
+            Slot *candidate = slots[(next + i) % slots.size()].get();
+            if (!candidate->busy)
+            {
+                slot = candidate;
+                next = (next + i + 1) % slots.size();
+            }
+        }
+        if (!slot)
+        {
+            // Every buffer is still held by the caller: grow rather than stall
+            slots.emplace_back(new Slot());
+            slot = slots.back().get();
+        }
+        if (slot->capacity < size)
+        {
+            // Immutable storage cannot be resized: allocate a new buffer
+            if (slot->buffer)
+                glState().deleteBuffers(1, &slot->buffer);
+            if (persistent)
+            {
+                GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                slot->buffer = createBufferStorage(GL_PIXEL_PACK_BUFFER, size, nullptr, flags);
+                slot->mapped = static_cast<uint8_t *>(mapBufferRange(GL_PIXEL_PACK_BUFFER, slot->buffer, 0, size, flags));
+            }
+            else
+            {
+                glGenBuffers(1, &slot->buffer);
+                glState().bindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+                glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+            }
+            slot->capacity = size;
+        }
+        glState().bindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+        slot->size = size;
+        slot->busy = true;
+        return slot;
+    }
+
+    void submit(Slot &slot)
+    {
+        // Client memory readbacks (glGetTexImage into a pointer) expect no pack buffer
+        glState().bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    bool persistent;
+    std::vector<std::unique_ptr<Slot>> slots;
+    size_t next = 0;
+};
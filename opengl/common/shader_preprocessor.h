@@ -0,0 +1,164 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// GLSL preprocessing done before glShaderSource:
+//  - '#include "file.glsl"' is replaced by the file content (looked up in the shader directory).
+//    A file is included only once, '#line' directives keep compiler messages pointing at
+//    the right line, source string N being the N-th file listed by the preprocessor.
+//  - defines are injected right after the '#version' line, so that shaders can declare
+//    tunables with '#ifndef NAME / #define NAME <default> / #endif' and be specialized
+//    (tile size, radius, local size...) without maintaining copies.
+
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+
+// Ordered list of (name, value) defines
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+// A named specialization of a shader source
+struct ShaderVariant
+{
+    std::string name;
+    ShaderDefines defines;
+};
+
+std::string definesToString(const ShaderDefines &defines)
+{
+    std::string result;
+    for (auto &define : defines)
+    {
+        result += "#define " + define.first + " " + define.second + "\n";
+    }
+    return result;
+}
+
+// Value of define 'name', or 'defaultValue' if not defined
+std::string getDefine(const ShaderDefines &defines, const std::string &name, const std::string &defaultValue)
+{
+    for (auto &define : defines)
+    {
+        if (define.first == name)
+        {
+            return define.second;
+        }
+    }
+    return defaultValue;
+}
+
+struct PreprocessedShader
+{
+    std::string source;
+    std::vector<std::string> files; // Source string numbers used in '#line' directives
+    std::string error;
+};
+
+static bool parseIncludeDirective(const std::string &line, std::string &includeName)
+{
+    std::string::size_type pos = line.find_first_not_of(" \t");
+    if (pos == std::string::npos || line.compare(pos, 8, "#include") != 0)
+    {
+        return false;
+    }
+    std::string::size_type begin = line.find_first_of("\"<", pos + 8);
+    std::string::size_type end = begin == std::string::npos ? begin : line.find_first_of("\">", begin + 1);
+    includeName = end == std::string::npos ? "" : line.substr(begin + 1, end - begin - 1);
+    return true;
+}
+
+static bool resolveIncludes(const std::string &filename, PreprocessedShader &shader,
+                            std::vector<std::string> &includeStack, std::set<std::string> &included)
+{
+    std::string content;
+    if (!loadFile(getShaderDirectory() + filename, content))
+    {
+        shader.error = "cannot open '" + filename + "'" + (includeStack.empty() ? "" : " included from '" + includeStack.back() + "'");
+        return false;
+    }
+    int fileIndex = static_cast<int>(shader.files.size());
+    shader.files.push_back(filename);
+    included.insert(filename);
+    includeStack.push_back(filename);
+    if (fileIndex > 0)
+    {
+        shader.source += "#line 1 " + std::to_string(fileIndex) + "\n";
+    }
+
+    int lineNumber = 0;
+    std::string::size_type start = 0;
+    while (start < content.size())
+    {
+        std::string::size_type end = content.find('\n', start);
+        std::string line = content.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        start = end == std::string::npos ? content.size() : end + 1;
+        ++lineNumber;
+
+        std::string includeName;
+        if (!parseIncludeDirective(line, includeName))
+        {
+            shader.source += line + "\n";
+            continue;
+        }
+        if (includeName.empty())
+        {
+            shader.error = filename + ":" + std::to_string(lineNumber) + ": malformed #include";
+            return false;
+        }
+        for (auto &parent : includeStack)
+        {
+            if (parent == includeName)
+            {
+                shader.error = filename + ":" + std::to_string(lineNumber) + ": recursive #include of '" + includeName + "'";
+                return false;
+            }
+        }
+        if (included.count(includeName) == 0)
+        {
+            if (!resolveIncludes(includeName, shader, includeStack, included))
+            {
+                return false;
+            }
+        }
+        shader.source += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+    }
+    includeStack.pop_back();
+    return true;
+}
+
+// Load 'filename' from the shader directory, resolve its includes and inject 'defines'
+PreprocessedShader preprocessShader(const std::string &filename, const ShaderDefines &defines)
+{
+    PreprocessedShader shader;
+    std::vector<std::string> includeStack;
+    std::set<std::string> included;
+    if (!resolveIncludes(filename, shader, includeStack, included))
+    {
+        return shader;
+    }
+
+    // '#version' must stay the first directive, defines go right after it
+    std::string::size_type versionPos = shader.source.find("#version");
+    if (versionPos == std::string::npos)
+    {
+        shader.error = filename + ": missing #version directive";
+        return shader;
+    }
+    std::string::size_type versionEnd = shader.source.find('\n', versionPos);
+    int versionLine = 1;
+    for (std::string::size_type i = 0; i < versionPos; ++i)
+    {
+        versionLine += shader.source[i] == '\n';
+    }
+    std::string injected = definesToString(defines) + "#line " + std::to_string(versionLine + 1) + " 0\n";
+    shader.source.insert(versionEnd == std::string::npos ? shader.source.size() : versionEnd + 1, injected);
+    return shader;
+}
@@ -0,0 +1,16 @@
+// Image helpers shared by the image kernels: #include "image_ops.glsl"
+
+// Clamp 'xy' to the pixels of an image of size 'size', edge pixels are repeated
+ivec2 clampToImage(ivec2 xy, ivec2 size) {
+    return clamp(xy, ivec2(0, 0), size - 1);
+}
+
+// Easy color to gray scale conversion is to take the average of red, green and blue values
+uvec4 grayscale(uvec4 pixel) {
+    uint color = (pixel.r + pixel.g + pixel.b) / 3;
+    return uvec4(color, color, color, 255);
+}
+
+uvec4 invert(uvec4 pixel) {
+    return uvec4(255 - pixel.rgb, pixel.a);
+}
@@ -0,0 +1,437 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Raw video stream mode: frames are read on stdin, processed by an image kernel
+// (binding 0 = input image, binding 1 = output image) and written on stdout.
+// Supported formats are fixed-size raw RGBA frames and YUV4MPEG2 (Y4M) with
+// 4:2:0, 4:4:4 or mono 8-bit planes, so that a sample can be put in a ffmpeg pipe:
+//
+//   ffmpeg -i in.mp4 -f yuv4mpegpipe - | convert2gray --stream | ffmpeg -i - out.mp4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "gpu_timer.h"
+#include "trace.h"
+#include "readback.h"
+#include "upload.h"
+#include "compute_pipeline.h"
+
+enum class StreamFormat
+{
+    RawRGBA,
+    Y4M
+};
+
+enum class ChromaFormat
+{
+    C420,
+    C444,
+    Mono
+};
+
+struct StreamInfo
+{
+    StreamFormat format = StreamFormat::RawRGBA;
+    ChromaFormat chroma = ChromaFormat::C420;
+    int width = 0;
+    int height = 0;
+    std::string y4mHeader; // Y4M stream header, forwarded as is to the output
+};
+
+static uint8_t clampToByte(int v)
+{
+    return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Number of bytes of one frame (without the Y4M 'FRAME' line) as carried in the stream
+size_t streamFrameSize(const StreamInfo &info)
+{
+    size_t lumaSize = static_cast<size_t>(info.width) * info.height;
+    if (info.format == StreamFormat::RawRGBA)
+    {
+        return lumaSize * 4;
+    }
+    switch (info.chroma)
+    {
+    case ChromaFormat::C444:
+        return lumaSize * 3;
+    case ChromaFormat::Mono:
+        return lumaSize;
+    default:
+        return lumaSize + 2 * static_cast<size_t>((info.width + 1) / 2) * ((info.height + 1) / 2);
+    }
+}
+
+// Parse the 'YUV4MPEG2 W<w> H<h> ... C<chroma>' header line
+bool parseY4MHeader(const std::string &header, StreamInfo &info)
+{
+    if (header.compare(0, 9, "YUV4MPEG2") != 0)
+    {
+        return false;
+    }
+    info.format = StreamFormat::Y4M;
+    info.chroma = ChromaFormat::C420; // Y4M default
+    info.y4mHeader = header;
+    size_t pos = 9;
+    while (pos < header.size())
+    {
+        size_t end = header.find(' ', pos + 1);
+        std::string token = header.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+        if (!token.empty())
+        {
+            switch (token[0])
+            {
+            case 'W':
+                info.width = atoi(token.c_str() + 1);
+                break;
+            case 'H':
+                info.height = atoi(token.c_str() + 1);
+                break;
+            case 'C':
+                if (token.compare(0, 4, "C420") == 0)
+                    info.chroma = ChromaFormat::C420;
+                else if (token == "C444")
+                    info.chroma = ChromaFormat::C444;
+                else if (token == "Cmono")
+                    info.chroma = ChromaFormat::Mono;
+                else
+                {
+                    fprintf(stderr, "Unsupported Y4M colorspace '%s'\n", token.c_str());
+                    return false;
+                }
+                break;
+            }
+        }
+        pos = end;
+    }
+    return info.width > 0 && info.height > 0;
+}
+
+// Convert a Y4M frame (BT.601 limited range) to RGBA
+void yuvToRGBA(const StreamInfo &info, const uint8_t *src, uint8_t *rgba)
+{
+    int w = info.width;
+    int h = info.height;
+    const uint8_t *yPlane = src;
+    const uint8_t *uPlane = src + static_cast<size_t>(w) * h;
+    int cw = info.chroma == ChromaFormat::C444 ? w : (w + 1) / 2;
+    int ch = info.chroma == ChromaFormat::C444 ? h : (h + 1) / 2;
+    const uint8_t *vPlane = uPlane + static_cast<size_t>(cw) * ch;
+    int shift = info.chroma == ChromaFormat::C444 ? 0 : 1;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            int c = 298 * (yPlane[y * w + x] - 16);
+            int d = 0;
+            int e = 0;
+            if (info.chroma != ChromaFormat::Mono)
+            {
+                size_t ci = static_cast<size_t>(y >> shift) * cw + (x >> shift);
+                d = uPlane[ci] - 128;
+                e = vPlane[ci] - 128;
+            }
+            uint8_t *p = rgba + (static_cast<size_t>(y) * w + x) * 4;
+            p[0] = clampToByte((c + 409 * e + 128) >> 8);
+            p[1] = clampToByte((c - 100 * d - 208 * e + 128) >> 8);
+            p[2] = clampToByte((c + 516 * d + 128) >> 8);
+            p[3] = 255;
+        }
+    }
+}
+
+// Convert an RGBA frame back to Y4M planes (BT.601 limited range), chroma is averaged for 4:2:0
+void rgbaToYUV(const StreamInfo &info, const uint8_t *rgba, uint8_t *dst)
+{
+    int w = info.width;
+    int h = info.height;
+    uint8_t *yPlane = dst;
+    for (size_t i = 0; i < static_cast<size_t>(w) * h; ++i)
+    {
+        const uint8_t *p = rgba + i * 4;
+        yPlane[i] = clampToByte(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+    }
+    if (info.chroma == ChromaFormat::Mono)
+    {
+        return;
+    }
+    int step = info.chroma == ChromaFormat::C444 ? 1 : 2;
+    int cw = (w + step - 1) / step;
+    int ch = (h + step - 1) / step;
+    uint8_t *uPlane = dst + static_cast<size_t>(w) * h;
+    uint8_t *vPlane = uPlane + static_cast<size_t>(cw) * ch;
+    for (int cy = 0; cy < ch; ++cy)
+    {
+        for (int cx = 0; cx < cw; ++cx)
+        {
+            int r = 0, g = 0, b = 0, n = 0;
+            for (int y = cy * step; y < std::min(h, cy * step + step); ++y)
+            {
+                for (int x = cx * step; x < std::min(w, cx * step + step); ++x)
+                {
+                    const uint8_t *p = rgba + (static_cast<size_t>(y) * w + x) * 4;
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                    ++n;
+                }
+            }
+            r /= n;
+            g /= n;
+            b /= n;
+            uPlane[cy * cw + cx] = clampToByte(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            vPlane[cy * cw + cx] = clampToByte(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+// Read one line (without '\n') from the stream, return false at end of stream
+bool readStreamLine(FILE *f, std::string &line)
+{
+    line.clear();
+    int c;
+    while ((c = fgetc(f)) != EOF && c != '\n')
+    {
+        line.push_back(static_cast<char>(c));
+    }
+    return c != EOF || !line.empty();
+}
+
+// Read the next frame as RGBA. 'scratch' holds the raw Y4M planes between calls.
+bool readStreamFrame(FILE *f, const StreamInfo &info, std::vector<uint8_t> &scratch, uint8_t *rgba)
+{
+    if (info.format == StreamFormat::RawRGBA)
+    {
+        return fread(rgba, 1, streamFrameSize(info), f) == streamFrameSize(info);
+    }
+    std::string frameLine;
+    if (!readStreamLine(f, frameLine) || frameLine.compare(0, 5, "FRAME") != 0)
+    {
+        return false;
+    }
+    scratch.resize(streamFrameSize(info));
+    if (fread(scratch.data(), 1, scratch.size(), f) != scratch.size())
+    {
+        return false;
+    }
+    yuvToRGBA(info, scratch.data(), rgba);
+    return true;
+}
+
+bool writeStreamFrame(FILE *f, const StreamInfo &info, std::vector<uint8_t> &scratch, const uint8_t *rgba)
+{
+    if (info.format == StreamFormat::RawRGBA)
+    {
+        return fwrite(rgba, 1, streamFrameSize(info), f) == streamFrameSize(info);
+    }
+    scratch.resize(streamFrameSize(info));
+    rgbaToYUV(info, rgba, scratch.data());
+    return fwrite("FRAME\n", 1, 6, f) == 6 && fwrite(scratch.data(), 1, scratch.size(), f) == scratch.size();
+}
+
+// One frame in flight: its textures and pack buffer are allocated once and reused for every frame
+struct StreamSlot
+{
+    GLuint inTex = 0;
+    GLuint outTex = 0;
+    ReadbackRing::Handle readback;
+    std::chrono::high_resolution_clock::time_point readTime;
+};
+
+// Run 'computeHandle' over every frame of stdin and write the processed frames on stdout.
+// 'size' is "<width>x<height>" for raw RGBA frames; when empty, stdin must be a Y4M stream.
+// Statistics are printed on stderr since stdout carries the video, the CPU/GPU timeline
+// is written to 'traceFile' when not empty.
+int runStream(GLuint computeHandle, int localSize, const std::string &size, int framesInFlight,
+              const std::string &traceFile = "")
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    StreamInfo info;
+    if (!size.empty())
+    {
+        if (sscanf(size.c_str(), "%dx%d", &info.width, &info.height) != 2 || info.width <= 0 || info.height <= 0)
+        {
+            fprintf(stderr, "Invalid frame size '%s' (expected <width>x<height>)\n", size.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        std::string header;
+        if (!readStreamLine(stdin, header) || !parseY4MHeader(header, info))
+        {
+            fprintf(stderr, "Input is not a supported Y4M stream (use --size WxH for raw RGBA frames)\n");
+            return 1;
+        }
+        fprintf(stdout, "%s\n", info.y4mHeader.c_str());
+    }
+    fprintf(stderr, "Stream: %s %ix%i, %i frames in flight\n",
+            info.format == StreamFormat::Y4M ? "Y4M" : "raw RGBA", info.width, info.height, framesInFlight);
+
+    int w = info.width;
+    int h = info.height;
+    size_t rgbaSize = static_cast<size_t>(w) * h * 4;
+
+    // The kernel is recorded once, each frame only sets the textures of its slot
+    ComputePipeline pipeline;
+    ComputePipeline::Resource inImage = pipeline.input();
+    ComputePipeline::Resource outImage = pipeline.input();
+    pipeline.step(computeHandle)
+        .image(0, inImage, GL_READ_ONLY, GL_RGBA8UI)
+        .image(1, outImage, GL_WRITE_ONLY, GL_RGBA8UI)
+        .dispatch((w + localSize - 1) / localSize, (h + localSize - 1) / localSize);
+    if (!pipeline.validate())
+    {
+        // Validated before any resource is created, so nothing to release
+        return 1;
+    }
+
+    std::vector<StreamSlot> slots(std::max(1, framesInFlight));
+    for (auto &slot : slots)
+    {
+        slot.inTex = createTextureStorage(0, GL_READ_ONLY, w, h);
+        slot.outTex = createTextureStorage(1, GL_WRITE_ONLY, w, h);
+    }
+    ReadbackRing readbacks(slots.size());
+    // Frames are read from stdin straight into the staging memory of the uploads
+    UploadRing uploads((slots.size() + 1) * rgbaSize);
+    GLErrorCheck("Stream resources");
+
+    std::vector<uint8_t> inScratch;
+    std::vector<uint8_t> outScratch;
+    std::vector<double> latencies;
+    std::vector<double> dispatchCpuTimes;
+    bool outputOk = true;
+
+    // Wait for the oldest frame of a slot, then write it on stdout
+    GPUTimerPool gpuTimers;
+    TraceRecorder trace;
+    if (!traceFile.empty())
+    {
+        trace.enable();
+        trace.attach(gpuTimers);
+    }
+
+    auto retire = [&](StreamSlot &slot) {
+        TraceRecorder::Scope scope(trace, "retire");
+        const uint8_t *pixels = slot.readback.wait();
+        outputOk = outputOk && pixels && writeStreamFrame(stdout, info, outScratch, pixels);
+        slot.readback.release();
+        auto now = std::chrono::high_resolution_clock::now();
+        latencies.push_back(std::chrono::duration<double, std::milli>(now - slot.readTime).count());
+    };
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+    size_t frameIndex = 0;
+    while (outputOk)
+    {
+        StreamSlot &slot = slots[frameIndex % slots.size()];
+        if (slot.readback.valid())
+        {
+            retire(slot);
+        }
+        UploadRing::Allocation staging;
+        {
+            TraceRecorder::Scope scope(trace, "read");
+            staging = uploads.allocate(rgbaSize);
+            if (!readStreamFrame(stdin, info, inScratch, staging.data))
+            {
+                break;
+            }
+        }
+        slot.readTime = std::chrono::high_resolution_clock::now();
+
+        // Upload into the slot's texture, run the kernel and start an asynchronous readback
+        TraceRecorder::Scope scope(trace, "submit");
+        gpuTimers.begin("upload");
+        uploads.uploadTexture(staging, slot.inTex, w, h);
+        gpuTimers.end("upload");
+        gpuTimers.begin("dispatch");
+        auto tDispatch = std::chrono::high_resolution_clock::now();
+        pipeline.set(inImage, slot.inTex);
+        pipeline.set(outImage, slot.outTex);
+        pipeline.run();
+        dispatchCpuTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tDispatch).count());
+        gpuTimers.end("dispatch");
+        gpuTimers.begin("barrier");
+        glBarriers().textureAccess(slot.outTex, GL_TEXTURE_UPDATE_BARRIER_BIT);
+        gpuTimers.end("barrier");
+        gpuTimers.begin("readback");
+        slot.readback = readbacks.readTexture(slot.outTex, w, h);
+        gpuTimers.end("readback");
+        gpuTimers.resolve();
+        if (frameIndex % 256 == 255)
+        {
+            // GPU and CPU clocks drift apart over long streams
+            trace.calibrate();
+        }
+        ++frameIndex;
+    }
+
+    // Drain the frames still in flight, oldest first
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        StreamSlot &slot = slots[(frameIndex + i) % slots.size()];
+        if (slot.readback.valid())
+        {
+            retire(slot);
+        }
+    }
+    fflush(stdout);
+    auto tEnd = std::chrono::high_resolution_clock::now();
+
+    for (auto &slot : slots)
+    {
+        glState().deleteTextures(1, &slot.inTex);
+        glState().deleteTextures(1, &slot.outTex);
+    }
+
+    double totalMs = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+    fprintf(stderr, "\n");
+    fprintf(stderr, "========== Stream statistics =============\n");
+    fprintf(stderr, "Frames            = %zu\n", latencies.size());
+    fprintf(stderr, "Throughput        = %f frames/s\n", totalMs > 0.0 ? latencies.size() * 1000.0 / totalMs : 0.0);
+    std::sort(latencies.begin(), latencies.end());
+    fprintf(stderr, "Latency p50       = %f ms\n", sortedPercentile(latencies, 50));
+    fprintf(stderr, "Latency p90       = %f ms\n", sortedPercentile(latencies, 90));
+    fprintf(stderr, "Latency p99       = %f ms\n", sortedPercentile(latencies, 99));
+    fprintf(stderr, "Latency max       = %f ms\n", sortedPercentile(latencies, 100));
+    fprintf(stderr, "Dispatch CPU p50  = %f ms\n", percentile(dispatchCpuTimes, 50));
+    gpuTimers.flush();
+    gpuTimers.print(stderr);
+    glState().print(stderr);
+    glBarriers().print(stderr);
+    fprintf(stderr, "==========================================\n");
+
+    if (!traceFile.empty() && !trace.write(traceFile))
+    {
+        fprintf(stderr, "Failed to write trace '%s'\n", traceFile.c_str());
+    }
+    if (!outputOk)
+    {
+        fprintf(stderr, "Failed to write frames on stdout\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// CPU + GPU timeline exported in the Chrome trace event format, viewable in
+// chrome://tracing or https://ui.perfetto.dev. CPU scopes are measured with
+// std::chrono, GPU scopes come from a GPUTimerPool; GPU timestamps are mapped on
+// the CPU time base thanks to a calibration with glGetInteger64v(GL_TIMESTAMP).
+// Nothing is recorded until enable() is called, so that scopes can be left in long
+// running loops when no trace is requested.
+//
+//   TraceRecorder trace;
+//   trace.enable();
+//   trace.attach(gpuTimers);
+//   {
+//       TraceRecorder::Scope scope(trace, "dispatch");
+//       ...
+//   }
+//   gpuTimers.flush();
+//   trace.write("trace.json");
+
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "gpu_timer.h"
+
+class TraceRecorder
+{
+public:
+    // RAII CPU scope
+    class Scope
+    {
+    public:
+        Scope(TraceRecorder &recorder, const std::string &name) : recorder(recorder), name(name), start(recorder.nowNs())
+        {
+        }
+        ~Scope()
+        {
+            recorder.addCPUEvent(name, start, recorder.nowNs());
+        }
+
+    private:
+        TraceRecorder &recorder;
+        std::string name;
+        int64_t start;
+    };
+
+    TraceRecorder() : origin(std::chrono::steady_clock::now())
+    {
+    }
+
+    // Start recording events (e.g. when a trace file is requested)
+    void enable()
+    {
+        enabled = true;
+        calibrate();
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    // Measure the offset between the GPU and the CPU clocks. Can be called again
+    // during long runs to compensate the drift between both clocks.
+    void calibrate()
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        int64_t cpuBefore = nowNs();
+        GLint64 gpuNs = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNs);
+        int64_t cpuAfter = nowNs();
+        gpuToCpuOffsetNs = (cpuBefore + cpuAfter) / 2 - gpuNs;
+    }
+
+    // Record the scopes resolved by 'timers' on the GPU track
+    void attach(GPUTimerPool &timers)
+    {
+        timers.setResolvedCallback([this](const std::string &name, GLuint64 beginNs, GLuint64 endNs) {
+            addGPUEvent(name, beginNs, endNs);
+        });
+    }
+
+    // CPU time in ns since the recorder creation
+    int64_t nowNs() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void addCPUEvent(const std::string &name, int64_t beginNs, int64_t endNs)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        events.push_back({name, CPUTrack, beginNs, endNs});
+    }
+
+    // 'beginNs' and 'endNs' are GPU timestamps (GL_TIMESTAMP)
+    void addGPUEvent(const std::string &name, GLuint64 beginNs, GLuint64 endNs)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        events.push_back({name, GPUTrack, static_cast<int64_t>(beginNs) + gpuToCpuOffsetNs, static_cast<int64_t>(endNs) + gpuToCpuOffsetNs});
+    }
+
+    bool write(const std::string &filename) const
+    {
+        FILE *f = fopen(filename.c_str(), "w");
+        if (!f)
+        {
+            return false;
+        }
+        fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": \"CPU\"}},\n", CPUTrack);
+        fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": \"GPU\"}}", GPUTrack);
+        for (auto &event : events)
+        {
+            fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %i, \"ts\": %.3f, \"dur\": %.3f}",
+                    escape(event.name).c_str(), event.track == CPUTrack ? "cpu" : "gpu", event.track,
+                    event.beginNs * 1e-3, (event.endNs - event.beginNs) * 1e-3);
+        }
+        fprintf(f, "\n]}\n");
+        return fclose(f) == 0;
+    }
+
+private:
+    enum Track
+    {
+        CPUTrack = 1,
+        GPUTrack = 2
+    };
+
+    struct Event
+    {
+        std::string name;
+        Track track;
+        int64_t beginNs;
+        int64_t endNs;
+    };
+
+    static std::string escape(const std::string &str)
+    {
+        std::string result;
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+            {
+                result.push_back('\\');
+            }
+            result.push_back(c);
+        }
+        return result;
+    }
+
+    std::chrono::steady_clock::time_point origin;
+    int64_t gpuToCpuOffsetNs = 0;
+    bool enabled = false;
+    std::vector<Event> events;
+};
@@ -0,0 +1,354 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#pragma once
+
+// Streaming uploads without per-image allocations nor blocking copies:
+//  - TexturePool recycles immutable textures keyed by (format, width, height) between jobs.
+//  - UploadRing is a GL_PIXEL_UNPACK_BUFFER persistently mapped (GL 4.4) and sub-allocated
+//    as a ring. Pixels are written straight into the mapping and glTexSubImage2D reads them
+//    from the buffer, so the driver can DMA them asynchronously. Each range is guarded by a
+//    fence and only overwritten once the GPU is done with it. When an allocation does not
+//    fit, the ring moves to a larger buffer; the previous one is only deleted once the GPU
+//    is done with it and its allocations are uploaded or discarded.
+//
+//   UploadRing uploads(64 << 20);
+//   UploadRing::Allocation staging = uploads.allocate(w * h * 4);
+//   decodeInto(staging.data);
+//   uploads.uploadTexture(staging, tex, w, h);
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <GL/gl3w.h>
+
+#include "gl_resources.h"
+#include "gl_state.h"
+
+class TexturePool
+{
+public:
+    TexturePool() = default;
+    TexturePool(const TexturePool &) = delete;
+    TexturePool &operator=(const TexturePool &) = delete;
+
+    ~TexturePool()
+    {
+        clear();
+    }
+
+    // A texture of the given format and size, recycled if one was released before
+    GLuint acquire(GLenum internalFormat, int width, int height)
+    {
+        Key key(internalFormat, width, height);
+        std::vector<GLuint> &available = freeTextures[key];
+        if (!available.empty())
+        {
+            GLuint tex = available.back();
+            available.pop_back();
+            return tex;
+        }
+        GLuint tex = createTexture2D(internalFormat, width, height);
+        keys[tex] = key;
+        ++created;
+        return tex;
+    }
+
+    // Give 'tex' back to the pool (its content is kept until it is acquired again)
+    void release(GLuint tex)
+    {
+        auto it = keys.find(tex);
+        if (it != keys.end())
+        {
+            freeTextures[it->second].push_back(tex);
+        }
+    }
+
+    // Delete every texture, released or not
+    void clear()
+    {
+        for (auto &texture : keys)
+        {
+            glState().deleteTextures(1, &texture.first);
+        }
+        keys.clear();
+        freeTextures.clear();
+    }
+
+    // Number of textures allocated since the pool creation
+    size_t createdCount() const
+    {
+        return created;
+    }
+
+private:
+    typedef std::tuple<GLenum, int, int> Key;
+    std::map<Key, std::vector<GLuint>> freeTextures;
+    std::map<GLuint, Key> keys;
+    size_t created = 0;
+};
+
+class UploadRing
+{
+public:
+    struct Allocation
+    {
+        uint8_t *data = nullptr; // Where to write the pixels
+        size_t offset = 0;       // Offset in the unpack buffer
+        size_t size = 0;
+        GLuint buffer = 0;       // The unpack buffer
+    };
+
+    // The ring grows on demand when 'capacity' is too small for an allocation
+    explicit UploadRing(size_t capacity = 0) : persistent(gl3wIsSupported(4, 4) != 0)
+    {
+        if (capacity > 0)
+        {
+            createBuffer(capacity);
+        }
+    }
+
+    ~UploadRing()
+    {
+        destroy();
+    }
+
+    UploadRing(const UploadRing &) = delete;
+    UploadRing &operator=(const UploadRing &) = delete;
+
+    // Reserve 'size' bytes of staging memory, waiting for the GPU only if the ring wrapped
+    // onto a range still being read. The allocation must be uploaded before the next one.
+    Allocation allocate(size_t size)
+    {
+        size_t alignedSize = (size + Alignment - 1) / Alignment * Alignment;
+        releaseRetiredBuffers(false);
+        if (alignedSize > capacity)
+        {
+            // Too small for this image: grow, without waiting for the uploads in flight
+            retireBuffer();
+            createBuffer(alignedSize);
+        }
+        if (head + alignedSize > capacity)
+        {
+            head = 0;
+        }
+        // Retire the in flight ranges overlapping [head, head + alignedSize), oldest first
+        while (std::any_of(inFlight.begin(), inFlight.end(), [&](const Range &range) { return overlaps(range, head, alignedSize); }))
+        {
+            glClientWaitSync(inFlight.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(inFlight.front().fence);
+            inFlight.pop_front();
+        }
+
+        Allocation allocation;
+        allocation.offset = head;
+        allocation.size = alignedSize;
+        allocation.buffer = buffer;
+        ++outstanding[buffer];
+        if (persistent)
+        {
+            allocation.data = mapped + head;
+        }
+        else
+        {
+            // Fences already guarantee that the range is not used anymore
+            glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+            allocation.data = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, head, alignedSize,
+                                                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+            glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        head += alignedSize;
+        return allocation;
+    }
+
+    // Upload the w x h RGBA pixels written in 'allocation' into 'tex' (level 0)
+    void uploadTexture(const Allocation &allocation, GLuint tex, int w, int h, GLenum format = GL_RGBA_INTEGER)
+    {
+        glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, allocation.buffer);
+        if (!persistent)
+        {
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        updateTexture2D(tex, w, h, format, reinterpret_cast<const void *>(allocation.offset));
+        glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        complete(allocation);
+    }
+
+    // Copy the first 'size' bytes written in 'allocation' into 'destination' at 'destinationOffset'
+    void uploadBuffer(const Allocation &allocation, size_t size, GLuint destination, size_t destinationOffset = 0)
+    {
+        if (!persistent)
+        {
+            glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, allocation.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        copyBufferData(allocation.buffer, destination, allocation.offset, destinationOffset, size);
+        complete(allocation);
+    }
+
+    // Give up the last allocation (e.g. decoding failed)
+    void discard(const Allocation &allocation)
+    {
+        if (!persistent)
+        {
+            glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, allocation.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        --outstanding[allocation.buffer];
+        if (allocation.buffer == buffer && head == allocation.offset + allocation.size)
+        {
+            head = allocation.offset;
+        }
+    }
+
+    // Copy 'pixels' (w x h RGBA) into the ring and upload them into 'tex'
+    void uploadTexture(GLuint tex, int w, int h, const uint8_t *pixels)
+    {
+        size_t size = static_cast<size_t>(w) * h * 4;
+        Allocation allocation = allocate(size);
+        memcpy(allocation.data, pixels, size);
+        uploadTexture(allocation, tex, w, h);
+    }
+
+    // Wait for the pending uploads and delete the buffers (e.g. before the context is destroyed).
+    // Allocations not uploaded yet become invalid.
+    void destroy()
+    {
+        releaseRetiredBuffers(true);
+        for (auto &range : inFlight)
+        {
+            glClientWaitSync(range.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(range.fence);
+        }
+        inFlight.clear();
+        if (buffer)
+        {
+            glState().deleteBuffers(1, &buffer);
+            buffer = 0;
+        }
+        mapped = nullptr;
+        capacity = 0;
+        head = 0;
+        outstanding.clear();
+    }
+
+private:
+    static const size_t Alignment = 256;
+
+    struct Range
+    {
+        size_t offset;
+        size_t size;
+        GLsync fence;
+    };
+
+    // Buffer replaced by a larger one, deleted once 'fence' is signaled and its allocations are completed
+    struct RetiredBuffer
+    {
+        GLuint buffer;
+        GLsync fence;
+    };
+
+    // The uploads from 'allocation' are submitted
+    void complete(const Allocation &allocation)
+    {
+        --outstanding[allocation.buffer];
+        if (allocation.buffer == buffer)
+        {
+            inFlight.push_back({allocation.offset, allocation.size, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+        }
+        else
+        {
+            // Upload from a retired buffer: its fence must cover this upload too
+            for (auto &retired : retiredBuffers)
+            {
+                if (retired.buffer == allocation.buffer)
+                {
+                    glDeleteSync(retired.fence);
+                    retired.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                }
+            }
+        }
+    }
+
+    // Replace the ranges in flight by a single fence, fences being signaled in order
+    void retireBuffer()
+    {
+        for (auto &range : inFlight)
+        {
+            glDeleteSync(range.fence);
+        }
+        inFlight.clear();
+        if (buffer)
+        {
+            retiredBuffers.push_back({buffer, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+        }
+        buffer = 0;
+        mapped = nullptr;
+        capacity = 0;
+        head = 0;
+    }
+
+    // Delete the retired buffers the GPU is done with, waiting for them if 'wait'
+    void releaseRetiredBuffers(bool wait)
+    {
+        for (auto it = retiredBuffers.begin(); it != retiredBuffers.end();)
+        {
+            GLenum status = glClientWaitSync(it->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? GL_TIMEOUT_IGNORED : 0);
+            bool done = status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+            if (!wait && (!done || outstanding[it->buffer] > 0))
+            {
+                ++it;
+                continue;
+            }
+            glDeleteSync(it->fence);
+            glState().deleteBuffers(1, &it->buffer);
+            outstanding.erase(it->buffer);
+            it = retiredBuffers.erase(it);
+        }
+    }
+
+    static bool overlaps(const Range &range, size_t offset, size_t size)
+    {
+        return range.offset < offset + size && offset < range.offset + range.size;
+    }
+
+    void createBuffer(size_t size)
+    {
+        capacity = (size + Alignment - 1) / Alignment * Alignment;
+        if (persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            buffer = createBufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+            mapped = static_cast<uint8_t *>(mapBufferRange(GL_PIXEL_UNPACK_BUFFER, buffer, 0, capacity, flags));
+        }
+        else
+        {
+            glGenBuffers(1, &buffer);
+            glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+        }
+        glState().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    bool persistent;
+    GLuint buffer = 0;
+    uint8_t *mapped = nullptr;
+    size_t capacity = 0;
+    size_t head = 0;
+    std::deque<Range> inFlight;
+    std::vector<RetiredBuffer> retiredBuffers;
+    std::map<GLuint, int> outstanding; // Allocations not uploaded nor discarded yet, per buffer
+};
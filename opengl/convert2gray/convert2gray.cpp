@@ -21,24 +21,139 @@
 #include <iterator>
 #include <numeric>
 #include <chrono>
+#include <map>
+#include <string>
 
 #include "helper.h"
 #include "gl_helper.h"
+#include "image_writer.h"
+#include "png_gpu_filter.h"
+#include "stream_helper.h"
+#include "gl_context_pool.h"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "image_loader.h"
 
+// Convert every file of 'inputs' into '<name>_bw<extension>' (current directory),
+// spreading the images over 'workerCount' GL contexts. Inputs sharing the same file
+// name are told apart by their index: '<name>_<index>_bw<extension>'.
+int convertFiles(const std::vector<std::string> &inputs, int workerCount, bool shared, const std::string &extension, int pngLevel)
+{
+    auto tStart = std::chrono::high_resolution_clock::now();
+    std::vector<std::future<bool>> results;
+    bool ok = true;
+    {
+        GLContextPool pool(workerCount, shared);
+        if (pool.size() == 0)
+        {
+            fprintf(stderr, "Failed to create worker contexts\n");
+            return 1;
+        }
+        printf("Converting %zu images on %zu %s GL contexts\n", inputs.size(), pool.size(), shared ? "shared" : "independent");
+        std::map<std::string, int> nameCount;
+        for (auto &input : inputs)
+        {
+            ++nameCount[input.substr(input.find_last_of("/\\") + 1)];
+        }
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            const std::string &input = inputs[i];
+            std::string name = input.substr(input.find_last_of("/\\") + 1);
+            std::string output = name.substr(0, name.find_last_of('.'));
+            if (nameCount[name] > 1)
+            {
+                output += "_" + std::to_string(i);
+            }
+            output += "_bw" + extension;
+            results.push_back(pool.submit([input, output, pngLevel](GLContextPool::Worker &worker) {
+                // Decoded straight into the worker's staging memory, textures are recycled between images
+                int w, h;
+                GLuint inTex = loadTexture(input, worker.uploads(), worker.textures, w, h);
+                if (!inTex)
+                {
+                    fprintf(stderr, "Failed to load '%s'\n", input.c_str());
+                    return false;
+                }
+                GLuint outTex = worker.textures.acquire(GL_RGBA8UI, w, h);
+                glState().bindImageTexture(0, inTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+                glState().bindImageTexture(1, outTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+
+                glState().useProgram(worker.program("convert2gray.comp"));
+                int localSize = 16;
+                glBarriers().textureAccess(outTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT); // Recycled texture
+                glDispatchCompute((w + localSize - 1) / localSize, (h + localSize - 1) / localSize, 1);
+                glBarriers().imageWritten(outTex);
+
+                bool saved = saveTexture(outTex, w, h, output, pngLevel);
+                worker.textures.release(inTex);
+                worker.textures.release(outTex);
+                if (!saved)
+                {
+                    fprintf(stderr, "Failed to save '%s'\n", output.c_str());
+                    return false;
+                }
+                printf("[context %i] '%s' saved to '%s'\n", worker.index(), input.c_str(), output.c_str());
+                return true;
+            }));
+        }
+        for (auto &result : results)
+        {
+            try
+            {
+                ok = result.get() && ok;
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "%s\n", e.what());
+                ok = false;
+            }
+        }
+    }
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    double totalMs = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+    printf("Converted %zu images in %f ms (%f images/s)\n", inputs.size(), totalMs, totalMs > 0.0 ? inputs.size() * 1000.0 / totalMs : 0.0);
+    return ok ? 0 : 1;
+}
 
-int main()
+
+int main(int argc, char **argv)
 {
+    std::vector<std::string> inputFiles = getPositionalArguments(argc, argv, {"--size", "--frames-in-flight", "--trace", "--output", "--png-level", "--workers", "--region"});
+
+    // Decode the input files (Lenna.png by default) into the image cache, later runs map the pixels
+    if (hasOption(argc, argv, "--prewarm-cache"))
+    {
+        return prewarmImageCache(inputFiles.empty() ? std::vector<std::string>{getBinDirectory() + "Lenna.png"} : inputFiles) == 0 ? 0 : 1;
+    }
+
     if (!initGL())
     {
         fprintf(stderr, "Failed to initialize GL!\n");
         return 1;
     }
 
+    // Stream mode: process raw frames from stdin to stdout (stdout only carries frames)
+    if (hasOption(argc, argv, "--stream"))
+    {
+        GLuint streamHandle = createComputeShader("convert2gray.comp");
+        int framesInFlight = atoi(getOptionValue(argc, argv, "--frames-in-flight", "3").c_str());
+        int result = runStream(streamHandle, 16, getOptionValue(argc, argv, "--size"), framesInFlight,
+                               getOptionValue(argc, argv, "--trace"));
+        closeGL();
+        return result;
+    }
+
+    // Batch mode: convert the input files given on the command line on a pool of GL contexts
+    if (!inputFiles.empty())
+    {
+        int workers = atoi(getOptionValue(argc, argv, "--workers", std::to_string(std::thread::hardware_concurrency())).c_str());
+        std::string output = getOptionValue(argc, argv, "--output", "bw.png");
+        std::string extension = output.find('.') == std::string::npos ? ".png" : output.substr(output.find_last_of('.'));
+        int pngLevel = atoi(getOptionValue(argc, argv, "--png-level", "6").c_str());
+        int result = convertFiles(inputFiles, workers, hasOption(argc, argv, "--shared-contexts"), extension, pngLevel);
+        closeGL();
+        return result;
+    }
+
     printGLInfo();
 
     // Compile the compute shader and get its handle
@@ -49,32 +164,54 @@ int main()
     int h;
     int numChannels = 4;
 
-    // Load an image to a texture
+    // Load an image to a texture, decoded straight into the staging memory of the upload
     std::string inputFilePath = getBinDirectory() + "Lenna.png";
-    int inputNumChannels;
-    auto input = stbi_load(inputFilePath.c_str(), &w, &h, &inputNumChannels, numChannels); // Force image to load with 4 channels
-    if (!input) {
+    UploadRing uploads;
+    TexturePool textures;
+    GLuint inTex = loadTexture(inputFilePath, uploads, textures, w, h); // Force image to load with 4 channels
+    if (!inTex) {
         fprintf(stderr, "Failed to load '%s'\n", inputFilePath.c_str());
         exit(39);
     }
     printf("Image loaded (width = %i, height = %i, number_channels = %i)\n", w, h, numChannels);
-    GLuint inTex = createTextureStorage(0, GL_READ_ONLY, w, h, input);
+    glState().bindImageTexture(0, inTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
 
     // Create the texture that will host the Black and white image
     GLuint outTex = createTextureStorage(1, GL_WRITE_ONLY, w, h); // Compute shader only write to RGBA format texture
 
     // Execute the compute shader with 16x16-size workgroups
-    glUseProgram(computeHandle);
+    glState().useProgram(computeHandle);
     int localSize = 16;
     glDispatchCompute((w + localSize - 1) / localSize , (h + localSize - 1) / localSize, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    glBarriers().imageWritten(outTex);
     
-    // Buffer with 4 1-byte channels to store the texture data
-    auto img = readTextureStorage(outTex, numChannels, w, h);
-    const char* imgfile = "bw.png";
-    stbi_write_png(imgfile, w, h, numChannels /* bytes per pixel */, img.data(), w * numChannels);
-    printf("Image saved to '%s'\n", imgfile);
+    // Save the texture data (4 1-byte channels), the format is given by the file extension
+    std::string imgfile = getOptionValue(argc, argv, "--output", "bw.png");
+    int pngLevel = atoi(getOptionValue(argc, argv, "--png-level", "6").c_str());
+    // Optional region of interest: only these pixels are read back and saved
+    int rx = 0, ry = 0, rw = w, rh = h;
+    std::string region = getOptionValue(argc, argv, "--region");
+    if (!region.empty() &&
+        (sscanf(region.c_str(), "%i,%i,%i,%i", &rx, &ry, &rw, &rh) != 4 || rx < 0 || ry < 0 || rw <= 0 || rh <= 0 || rx + rw > w || ry + rh > h)) {
+        fprintf(stderr, "Invalid region '%s' (expected <x>,<y>,<width>,<height> inside the image)\n", region.c_str());
+        exit(43);
+    }
+    // With --gpu-png-filter, PNG rows are filtered on the GPU and the CPU only deflates them
+    bool saved;
+    if (hasOption(argc, argv, "--gpu-png-filter")) {
+        GpuPNGFilter pngFilter;
+        saved = pngFilter.saveTextureRegion(outTex, rx, ry, rw, rh, imgfile, pngLevel);
+    } else {
+        saved = saveTextureRegion(outTex, rx, ry, rw, rh, imgfile, pngLevel);
+    }
+    if (!saved) {
+        fprintf(stderr, "Failed to save '%s'\n", imgfile.c_str());
+        exit(42);
+    }
+    printf("Image saved to '%s'\n", imgfile.c_str());
 
+    textures.clear();
+    uploads.destroy();
     closeGL();
 
     return 0;
@@ -0,0 +1,464 @@
+// Software Name : compute_shader_samples
+// SPDX-FileCopyrightText: Copyright (c) 2024 Cédric CHEDALEUX
+// SPDX-License-Identifier: MIT
+//
+// This software is distributed under the MIT License;
+// see the LICENSE file for more details.
+//
+// Author: Cédric CHEDALEUX <cedric.chedaleux@orange.com> et al
+
+#ifdef _WIN32
+// #pragma comment(lib, "glfw3.lib")
+#pragma comment(lib, "OpenGL32.Lib")
+#include <windows.h>
+#endif
+
+#include <GL/gl3w.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+#include "helper.h"
+#include "gl_helper.h"
+
+// Benchmark harness running the kernels of every sample at several problem sizes. Each
+// (kernel, size) pair runs warmup iterations then timed ones, an iteration being the upload
+// of the inputs, the dispatch(es) and the readback of the outputs, serialized with glFinish
+// so that every phase is measured alone. Min, median, p95 and p99 of the GPU time (timer
+// query around the dispatches), the CPU wall time of the iteration and the transfer time
+// (upload + readback) are printed as a table and written as JSON, along with the GL driver
+// strings, to compare drivers and hardware.
+
+// One kernel at one problem size, resources allocated by Kernel::create
+struct Workload
+{
+    std::function<void()> upload;   // Inputs from CPU memory (may be empty)
+    std::function<void()> dispatch; // Kernel(s) only
+    std::function<void()> readback; // Outputs to CPU memory
+    std::function<void()> release;
+    size_t transferBytes = 0;
+};
+
+struct Kernel
+{
+    std::string name; // "family/variant", --kernels accepts both
+    std::function<Workload(int w, int h)> create;
+};
+
+struct Summary
+{
+    double minMs = 0.0;
+    double medianMs = 0.0;
+    double p95Ms = 0.0;
+    double p99Ms = 0.0;
+};
+
+struct Result
+{
+    std::string kernel;
+    int w = 0;
+    int h = 0;
+    size_t transferBytes = 0;
+    Summary gpu;
+    Summary wall;
+    Summary transfer;
+};
+
+Summary summarize(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    Summary summary;
+    summary.minMs = sortedPercentile(samples, 0);
+    summary.medianMs = sortedPercentile(samples, 50);
+    summary.p95Ms = sortedPercentile(samples, 95);
+    summary.p99Ms = sortedPercentile(samples, 99);
+    return summary;
+}
+
+std::vector<std::string> splitList(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::string::size_type start = 0;
+    while (start <= list.size())
+    {
+        std::string::size_type comma = list.find(',', start);
+        std::string item = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (!item.empty())
+            items.push_back(item);
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+    return items;
+}
+
+// Deterministic RGBA input of the image kernels
+std::vector<uint8_t> createTestImage(int w, int h)
+{
+    std::vector<uint8_t> pixels(static_cast<size_t>(w) * h * 4);
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            uint8_t *px = pixels.data() + (static_cast<size_t>(y) * w + x) * 4;
+            px[0] = static_cast<uint8_t>(x);
+            px[1] = static_cast<uint8_t>(y);
+            px[2] = static_cast<uint8_t>((x * 7) ^ (y * 13));
+            px[3] = 255;
+        }
+    }
+    return pixels;
+}
+
+// times2 of ssbo_sample.comp on w * h integers
+Workload createTimes2(int w, int h)
+{
+    const int localSize = 256;
+    size_t count = static_cast<size_t>(w) * h;
+    // Groups beyond the x limit (65535 at least) are spread over y, e.g. at 16Kx16K
+    GLint maxGroupsX = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroupsX);
+    size_t groups = (count + localSize - 1) / localSize;
+    GLuint groupsX = static_cast<GLuint>(std::min<size_t>(groups, static_cast<size_t>(std::max(maxGroupsX, 1))));
+    GLuint groupsY = static_cast<GLuint>((groups + groupsX - 1) / groupsX);
+    size_t padded = static_cast<size_t>(groupsX) * groupsY * localSize; // The kernel has no bounds check
+    GLuint program = createComputeShader("ssbo_sample.comp", {{"LOCAL_SIZE", std::to_string(localSize)}});
+    auto inputs = std::make_shared<std::vector<int>>(padded);
+    std::iota(inputs->begin(), inputs->end(), 1);
+    auto outputs = std::make_shared<std::vector<int>>(padded);
+    GLuint inputSSBO = createBufferStorage(GL_SHADER_STORAGE_BUFFER, padded * sizeof(int), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    GLuint outputSSBO = createBufferStorage(GL_SHADER_STORAGE_BUFFER, padded * sizeof(int), nullptr, 0);
+
+    Workload workload;
+    workload.transferBytes = 2 * padded * sizeof(int);
+    workload.upload = [=]() {
+        updateBufferData(GL_SHADER_STORAGE_BUFFER, inputSSBO, 0, padded * sizeof(int), inputs->data());
+    };
+    workload.dispatch = [=]() {
+        glBarriers().bufferAccess(inputSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+        glBarriers().bufferAccess(outputSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+        glState().bindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, inputSSBO);
+        glState().bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, outputSSBO);
+        glState().useProgram(program);
+        glDispatchCompute(groupsX, groupsY, 1);
+        glBarriers().bufferWritten(outputSSBO);
+    };
+    workload.readback = [=]() {
+        getBufferData(GL_SHADER_STORAGE_BUFFER, outputSSBO, 0, padded * sizeof(int), outputs->data());
+    };
+    workload.release = [=]() {
+        GLuint buffers[] = {inputSSBO, outputSSBO};
+        glState().deleteBuffers(2, buffers);
+        glState().deleteProgram(program);
+    };
+    return workload;
+}
+
+// Image to image kernel with 16x16 groups (convert2gray.comp, boxblur.comp...):
+// input on image unit 0, output on image unit 1
+Workload createImageKernel(const std::string &shader, const ShaderDefines &defines, int w, int h)
+{
+    GLuint program = createComputeShader(shader, defines);
+    auto pixels = std::make_shared<std::vector<uint8_t>>(createTestImage(w, h));
+    auto outputs = std::make_shared<std::vector<uint8_t>>(pixels->size());
+    GLuint inTex = createTexture2D(GL_RGBA8UI, w, h);
+    GLuint outTex = createTexture2D(GL_RGBA8UI, w, h);
+
+    Workload workload;
+    workload.transferBytes = 2 * pixels->size();
+    workload.upload = [=]() {
+        updateTexture2D(inTex, w, h, GL_RGBA_INTEGER, pixels->data());
+    };
+    workload.dispatch = [=]() {
+        glBarriers().textureAccess(inTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glBarriers().textureAccess(outTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glState().bindImageTexture(0, inTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+        glState().bindImageTexture(1, outTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+        glState().useProgram(program);
+        glDispatchCompute((w + 15) / 16, (h + 15) / 16, 1);
+        glBarriers().imageWritten(outTex);
+    };
+    workload.readback = [=]() {
+        getTextureImage(outTex, GL_RGBA_INTEGER, outputs->size(), outputs->data());
+    };
+    workload.release = [=]() {
+        GLuint textures[] = {inTex, outTex};
+        glState().deleteTextures(2, textures);
+        glState().deleteProgram(program);
+    };
+    return workload;
+}
+
+// Procedural image of img_generation.comp, nothing to upload
+Workload createGenerator(int generator, int w, int h)
+{
+    GLuint program = createComputeShader("img_generation.comp");
+    glProgramUniform1i(program, glGetUniformLocation(program, "generator"), generator);
+    glProgramUniform2i(program, glGetUniformLocation(program, "fullSize"), w, h);
+    auto outputs = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(w) * h * 4);
+    GLuint outTex = createTexture2D(GL_RGBA8UI, w, h);
+
+    Workload workload;
+    workload.transferBytes = outputs->size();
+    workload.dispatch = [=]() {
+        glBarriers().textureAccess(outTex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glState().bindImageTexture(0, outTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+        glState().useProgram(program);
+        glDispatchCompute((w + 31) / 32, (h + 31) / 32, 1);
+        glBarriers().imageWritten(outTex);
+    };
+    workload.readback = [=]() {
+        getTextureImage(outTex, GL_RGBA_INTEGER, outputs->size(), outputs->data());
+    };
+    workload.release = [=]() {
+        glState().deleteTextures(1, &outTex);
+        glState().deleteProgram(program);
+    };
+    return workload;
+}
+
+std::vector<Kernel> registerKernels(int radius)
+{
+    ShaderDefines blurDefines = {{"BLUR_RADIUS", std::to_string(radius)}};
+    ShaderDefines globalBlurDefines = {{"BLUR_RADIUS", std::to_string(radius)}, {"USE_SHARED_MEMORY", "0"}};
+    std::vector<Kernel> kernels = {
+        {"times2", createTimes2},
+        {"grayscale", [](int w, int h) { return createImageKernel("convert2gray.comp", {}, w, h); }},
+        {"boxblur/shared", [=](int w, int h) { return createImageKernel("boxblur.comp", blurDefines, w, h); }},
+        {"boxblur/global", [=](int w, int h) { return createImageKernel("boxblur.comp", globalBlurDefines, w, h); }},
+        {"boxblur/fused", [=](int w, int h) { return createImageKernel("boxblur_fused.comp", blurDefines, w, h); }},
+    };
+    const char *generators[] = {"workgroups", "gradient", "mandelbrot", "noise"};
+    for (int i = 0; i < 4; ++i)
+    {
+        kernels.push_back({std::string("generate/") + generators[i], [=](int w, int h) { return createGenerator(i, w, h); }});
+    }
+    return kernels;
+}
+
+bool isSelected(const Kernel &kernel, const std::vector<std::string> &selection)
+{
+    std::string family = kernel.name.substr(0, kernel.name.find('/'));
+    return selection.empty() || std::find(selection.begin(), selection.end(), kernel.name) != selection.end() ||
+           std::find(selection.begin(), selection.end(), family) != selection.end();
+}
+
+Result runWorkload(const Kernel &kernel, int w, int h, int warmup, int iterations)
+{
+    Workload workload = kernel.create(w, h);
+    std::vector<double> gpuMs, wallMs, transferMs;
+    GLTime gpuTime;
+    for (int i = 0; i < warmup + iterations; ++i)
+    {
+        glFinish();
+        auto tStart = std::chrono::high_resolution_clock::now();
+        if (workload.upload)
+        {
+            workload.upload();
+            glFinish();
+        }
+        auto tUploaded = std::chrono::high_resolution_clock::now();
+        gpuTime.start();
+        workload.dispatch();
+        gpuTime.end();
+        glFinish();
+        auto tDispatched = std::chrono::high_resolution_clock::now();
+        workload.readback();
+        auto tEnd = std::chrono::high_resolution_clock::now();
+        if (i < warmup)
+        {
+            continue;
+        }
+        gpuMs.push_back(gpuTime.timeInMs());
+        wallMs.push_back(std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+        transferMs.push_back(std::chrono::duration<double, std::milli>(tUploaded - tStart).count() +
+                             std::chrono::duration<double, std::milli>(tEnd - tDispatched).count());
+    }
+    workload.release();
+    GLErrorCheck(kernel.name.c_str());
+
+    Result result;
+    result.kernel = kernel.name;
+    result.w = w;
+    result.h = h;
+    result.transferBytes = workload.transferBytes;
+    result.gpu = summarize(gpuMs);
+    result.wall = summarize(wallMs);
+    result.transfer = summarize(transferMs);
+    return result;
+}
+
+void printResults(const std::vector<Result> &results, int warmup, int iterations)
+{
+    printf("\n");
+    printf("========== csbench (%i warmup, %i iterations) ==========\n", warmup, iterations);
+    printf("%-20s %-11s %-9s %12s %12s %12s %12s\n", "kernel", "size", "time", "min ms", "median ms", "p95 ms", "p99 ms");
+    for (const Result &result : results)
+    {
+        std::string size = std::to_string(result.w) + "x" + std::to_string(result.h);
+        const std::pair<const char *, const Summary *> metrics[] = {{"GPU", &result.gpu}, {"wall", &result.wall}, {"transfer", &result.transfer}};
+        for (auto &metric : metrics)
+        {
+            const Summary &s = *metric.second;
+            printf("%-20s %-11s %-9s %12f %12f %12f %12f\n", result.kernel.c_str(), size.c_str(), metric.first,
+                   s.minMs, s.medianMs, s.p95Ms, s.p99Ms);
+        }
+    }
+    printf("========================================================\n");
+}
+
+std::string jsonString(const char *value)
+{
+    std::string out = "\"";
+    for (const char *c = value ? value : ""; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(*c) >= 0x20)
+            out += *c;
+    }
+    return out + "\"";
+}
+
+void writeSummary(FILE *f, const char *name, const Summary &s, bool last)
+{
+    fprintf(f, "      \"%s\": {\"min\": %f, \"median\": %f, \"p95\": %f, \"p99\": %f}%s\n", name, s.minMs, s.medianMs, s.p95Ms, s.p99Ms, last ? "" : ",");
+}
+
+bool writeJson(const std::string &filename, const std::vector<Result> &results, int warmup, int iterations)
+{
+    FILE *f = filename == "-" ? stdout : fopen(filename.c_str(), "w");
+    if (!f)
+    {
+        return false;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"gl\": {\"vendor\": %s, \"renderer\": %s, \"version\": %s, \"glsl\": %s},\n",
+            jsonString(reinterpret_cast<const char *>(glGetString(GL_VENDOR))).c_str(),
+            jsonString(reinterpret_cast<const char *>(glGetString(GL_RENDERER))).c_str(),
+            jsonString(reinterpret_cast<const char *>(glGetString(GL_VERSION))).c_str(),
+            jsonString(reinterpret_cast<const char *>(glGetString(GL_SHADING_LANGUAGE_VERSION))).c_str());
+    fprintf(f, "  \"warmup\": %i,\n", warmup);
+    fprintf(f, "  \"iterations\": %i,\n", iterations);
+    fprintf(f, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &result = results[i];
+        fprintf(f, "    {\n");
+        fprintf(f, "      \"kernel\": %s,\n", jsonString(result.kernel.c_str()).c_str());
+        fprintf(f, "      \"width\": %i,\n", result.w);
+        fprintf(f, "      \"height\": %i,\n", result.h);
+        fprintf(f, "      \"transfer_bytes\": %zu,\n", result.transferBytes);
+        writeSummary(f, "gpu_ms", result.gpu, false);
+        writeSummary(f, "wall_ms", result.wall, false);
+        writeSummary(f, "transfer_ms", result.transfer, true);
+        fprintf(f, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+    if (f == stdout)
+    {
+        return fflush(f) == 0;
+    }
+    return fclose(f) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    // Blur radius of the boxblur kernels, whose (16 + 2 * radius)^2 uvec4 tile must fit in
+    // the 32 KB of shared memory every GPU has
+    const int maxRadius = 14;
+    int radius = 0;
+    if (!parseInt(getOptionValue(argc, argv, "--radius", "2"), 0, maxRadius, radius))
+    {
+        fprintf(stderr, "Invalid blur radius (expected 0 to %i)\n", maxRadius);
+        return 1;
+    }
+    std::vector<Kernel> kernels = registerKernels(radius);
+    if (hasOption(argc, argv, "--list"))
+    {
+        for (const Kernel &kernel : kernels)
+            printf("%s\n", kernel.name.c_str());
+        return 0;
+    }
+
+    int warmup = atoi(getOptionValue(argc, argv, "--warmup", "3").c_str());
+    int iterations = atoi(getOptionValue(argc, argv, "--iterations", "20").c_str());
+    if (warmup < 0 || iterations <= 0)
+    {
+        fprintf(stderr, "Invalid warmup or iteration count\n");
+        return 1;
+    }
+    std::vector<std::pair<int, int>> sizes;
+    for (const std::string &size : splitList(getOptionValue(argc, argv, "--sizes", "256x256,1024x1024,2048x2048")))
+    {
+        int w = 0, h = 0;
+        if (sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+        {
+            fprintf(stderr, "Invalid size '%s' (expected <width>x<height>)\n", size.c_str());
+            return 1;
+        }
+        sizes.emplace_back(w, h);
+    }
+    std::vector<std::string> selection = splitList(getOptionValue(argc, argv, "--kernels"));
+    for (const std::string &name : selection)
+    {
+        bool known = std::any_of(kernels.begin(), kernels.end(), [&](const Kernel &kernel) { return isSelected(kernel, {name}); });
+        if (!known)
+        {
+            fprintf(stderr, "Unknown kernel '%s' (see --list)\n", name.c_str());
+            return 1;
+        }
+    }
+
+    if (!initGL())
+    {
+        fprintf(stderr, "Failed to initialize GL!\n");
+        return 1;
+    }
+    printGLInfo();
+
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    std::vector<Result> results;
+    for (const Kernel &kernel : kernels)
+    {
+        if (!isSelected(kernel, selection))
+        {
+            continue;
+        }
+        for (auto &size : sizes)
+        {
+            if (size.first > maxTextureSize || size.second > maxTextureSize)
+            {
+                printf("Skipping %s at %ix%i (max texture size %i)\n", kernel.name.c_str(), size.first, size.second, maxTextureSize);
+                continue;
+            }
+            printf("Running %s at %ix%i\n", kernel.name.c_str(), size.first, size.second);
+            results.push_back(runWorkload(kernel, size.first, size.second, warmup, iterations));
+        }
+    }
+    printResults(results, warmup, iterations);
+
+    std::string jsonFile = getOptionValue(argc, argv, "--json", "csbench.json");
+    if (!writeJson(jsonFile, results, warmup, iterations))
+    {
+        fprintf(stderr, "Failed to write '%s'\n", jsonFile.c_str());
+        closeGL();
+        return 1;
+    }
+    if (jsonFile != "-")
+    {
+        printf("Results written to '%s'\n", jsonFile.c_str());
+    }
+
+    closeGL();
+    return 0;
+}
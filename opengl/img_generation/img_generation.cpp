@@ -21,16 +21,85 @@
 #include <iterator>
 #include <numeric>
 #include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <limits.h>
+#include <memory>
 
 #include "helper.h"
 #include "gl_helper.h"
+#include "image_writer.h"
+#include "readback.h"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+enum Generator
+{
+    Workgroups = 0, // One color per 32x32 block, as the original sample
+    Gradient = 1,
+    Mandelbrot = 2,
+    Noise = 3
+};
+
+int parseGenerator(const std::string &name)
+{
+    const char *names[] = {"workgroups", "gradient", "mandelbrot", "noise"};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (name == names[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
 
+// A tile being generated: its texture is reused by every other tile
+struct Tile
+{
+    GLuint tex = 0;
+    ReadbackRing::Handle readback;
+    int x = 0;
+    int y = 0;
+    int w = 0;
+    int h = 0;
+};
 
-int main()
+int main(int argc, char **argv)
 {
+    // Arguments are checked before the GL context is created, so that their errors need no cleanup
+
+    // Image size can be any size, images larger than the tile size are generated strip by strip
+    int w = 512;
+    int h = 512;
+    int numChannels = 4; // RGBA
+    std::string size = getOptionValue(argc, argv, "--size", "512x512");
+    if (sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+    {
+        fprintf(stderr, "Invalid image size '%s' (expected <width>x<height>)\n", size.c_str());
+        return 1;
+    }
+    int generator = parseGenerator(getOptionValue(argc, argv, "--generator", "workgroups"));
+    if (generator < 0)
+    {
+        fprintf(stderr, "Unknown generator (expected workgroups, gradient, mandelbrot or noise)\n");
+        return 1;
+    }
+    // Largest tile side, the texture size limit by default
+    std::string tileOption = getOptionValue(argc, argv, "--tile");
+    int tileSize = tileOption.empty() ? INT_MAX : atoi(tileOption.c_str());
+    if (tileSize <= 0)
+    {
+        fprintf(stderr, "Invalid tile size\n");
+        return 1;
+    }
+    std::string output = getOptionValue(argc, argv, "--output", "image.png");
+    int pngLevel = atoi(getOptionValue(argc, argv, "--png-level", "6").c_str());
+    ImageFormat format = imageFormatFromFilename(output);
+    if (format == ImageFormat::Unknown)
+    {
+        fprintf(stderr, "Unsupported output '%s' (expected png, pam, ppm, qoi, rgba or raw)\n", output.c_str());
+        return 1;
+    }
+
     if (!initGL())
     {
         fprintf(stderr, "Failed to initialize GL!\n");
@@ -39,36 +108,185 @@ int main()
 
     printGLInfo();
 
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    tileSize = std::min(tileSize, static_cast<int>(maxTextureSize));
+    // Full width strips unless the width alone exceeds the texture size limit
+    int tileW = w <= maxTextureSize ? w : tileSize;
+    int tileH = std::min(h, tileSize);
+    int tilesX = (w + tileW - 1) / tileW;
+    int tilesY = (h + tileH - 1) / tileH;
+
+    // Each tile is written as soon as it is read back: uncompressed formats are assembled in
+    // a single memory mapped file, strips are streamed into the PNG and QOI encoders. Only
+    // when the image is wider than a texture are compressed formats saved as one file per tile.
+    bool assembled = format == ImageFormat::PAM || format == ImageFormat::PPM || format == ImageFormat::RawRGBA;
+    bool separateFiles = !assembled && tilesX > 1;
+    MappedFile outputFile;
+    PNGStreamWriter pngOutput;
+    std::unique_ptr<QOIEncoder> qoiOutput;
+    std::string header = uncompressedImageHeader(format, w, h);
+    int outputChannels = format == ImageFormat::PPM ? 3 : 4;
+    bool opened = true;
+    if (assembled)
+    {
+        opened = outputFile.open(output, header.size() + static_cast<size_t>(w) * h * outputChannels);
+        if (opened)
+            memcpy(outputFile.data, header.data(), header.size());
+    }
+    else if (!separateFiles && format == ImageFormat::PNG)
+    {
+        opened = pngOutput.open(output, w, h, numChannels, pngLevel);
+    }
+    else if (!separateFiles)
+    {
+        opened = outputFile.open(output, qoiMaxSize(w, h));
+        if (opened)
+            qoiOutput.reset(new QOIEncoder(w, h, outputFile.data));
+    }
+    if (!opened)
+    {
+        fprintf(stderr, "Failed to open '%s'\n", output.c_str());
+        closeGL();
+        return 1;
+    }
+    std::string::size_type dot = output.find_last_of('.');
+    printf("Generating %ix%i image with %ix%i tiles (%i tiles)\n", w, h, tileW, tileH, tilesX * tilesY);
+
     // Compile the compute shader and get its handle
     GLuint computeHandle = createComputeShader("img_generation.comp");
+    glState().useProgram(computeHandle);
+    glUniform1i(glGetUniformLocation(computeHandle, "generator"), generator);
+    glUniform2i(glGetUniformLocation(computeHandle, "fullSize"), w, h);
+    GLint tileOffsetLocation = glGetUniformLocation(computeHandle, "tileOffset");
 
-    // Square image with power of two size
-    int w = 512;
-    int h = 512;
-    int numChannels = 4; // RGBA
+    // Two tiles in flight: the GPU generates a tile while the previous one is written on disk
+    Tile tiles[2];
+    for (int i = 0; i < std::min(2, tilesX * tilesY); ++i)
+    {
+        tiles[i].tex = createTextureStorage(0, GL_WRITE_ONLY, tileW, tileH);
+    }
+    ReadbackRing readbacks(2);
+    GLErrorCheck("Tile resources");
+
+    bool outputOk = true;
+    auto writeTile = [&](Tile &tile) {
+        const uint8_t *pixels = tile.readback.wait();
+        if (!pixels)
+        {
+            outputOk = false;
+        }
+        else if (assembled)
+        {
+            // Each tile row goes straight to its final location in the mapped file
+            for (int row = 0; row < tile.h; ++row)
+            {
+                const uint8_t *src = pixels + static_cast<size_t>(row) * tileW * numChannels;
+                uint8_t *dst = outputFile.data + header.size() + (static_cast<size_t>(tile.y + row) * w + tile.x) * outputChannels;
+                if (outputChannels == numChannels)
+                {
+                    memcpy(dst, src, static_cast<size_t>(tile.w) * numChannels);
+                }
+                else
+                {
+                    for (int x = 0; x < tile.w; ++x)
+                    {
+                        memcpy(dst + x * outputChannels, src + x * numChannels, outputChannels);
+                    }
+                }
+            }
+        }
+        else if (separateFiles)
+        {
+            std::string tileFile = output.substr(0, dot) + "_" + std::to_string(tile.y / tileH) + "_" + std::to_string(tile.x / tileW) + output.substr(dot);
+            outputOk = writeImage(tileFile, tile.w, tile.h, pixels, tileW * numChannels, pngLevel);
+        }
+        else if (qoiOutput)
+        {
+            qoiOutput->encodeRows(pixels, tile.h, tileW * numChannels);
+        }
+        else
+        {
+            outputOk = pngOutput.writeRows(pixels, tile.h, tileW * numChannels);
+        }
+        tile.readback.release();
+        if (tilesX * tilesY > 1)
+        {
+            printf("Tile (%i, %i) written\n", tile.x / tileW, tile.y / tileH);
+        }
+    };
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+    int tileCount = tilesX * tilesY;
+    for (int i = 0; i < tileCount && outputOk; ++i)
+    {
+        Tile &tile = tiles[i % 2];
+        if (tile.readback.valid())
+        {
+            writeTile(tile);
+        }
+        tile.x = (i % tilesX) * tileW;
+        tile.y = (i / tilesX) * tileH;
+        tile.w = std::min(tileW, w - tile.x);
+        tile.h = std::min(tileH, h - tile.y);
+
+        // Execute the compute shader in 32x32-size workgroups over the tile, rounding up for partial workgroups
+        glState().bindImageTexture(0, tile.tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
+        glUniform2i(tileOffsetLocation, tile.x, tile.y);
+        glBarriers().textureAccess(tile.tex, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glDispatchCompute((tile.w + 31) / 32, (tile.h + 31) / 32, 1);
+        glBarriers().imageWritten(tile.tex);
+
+        // Asynchronous readback of the tile
+        tile.readback = readbacks.readTexture(tile.tex, tileW, tileH);
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        Tile &tile = tiles[(tileCount + i) % 2];
+        if (tile.readback.valid())
+        {
+            writeTile(tile);
+        }
+    }
+    auto tEnd = std::chrono::high_resolution_clock::now();
+
+    if (assembled)
+    {
+        outputOk = outputFile.close(outputFile.size) && outputOk;
+    }
+    else if (qoiOutput)
+    {
+        outputOk = outputFile.close(qoiOutput->finish()) && outputOk;
+    }
+    else if (!separateFiles)
+    {
+        outputOk = pngOutput.close() && outputOk;
+    }
+    for (auto &tile : tiles)
+    {
+        glState().deleteTextures(1, &tile.tex);
+    }
+    readbacks.destroy();
+    if (!outputOk)
+    {
+        fprintf(stderr, "Failed to write '%s'\n", output.c_str());
+        closeGL();
+        return 1;
+    }
+    if (separateFiles)
+    {
+        printf("Image saved to '%s_<row>_<column>%s'\n", output.substr(0, dot).c_str(), output.substr(dot).c_str());
+    }
+    else
+    {
+        printf("Image saved to '%s'\n", output.c_str());
+    }
 
-    // Create the texture that will host the image
-    GLuint outTex;
-    glGenTextures(1, &outTex);
-    glBindTexture(GL_TEXTURE_2D, outTex);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, w, h); // Each pixel will be stored in 4 unsigned integer [0,255]
-    glActiveTexture(GL_TEXTURE0);
-    glBindImageTexture(0, outTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
-
-    // Execute the compute shader in 32x32-size workground
-    glUseProgram(computeHandle);
-    GLint location = glGetUniformLocation(computeHandle, "texture");
-    glUniform1i(location, 0);
-    glDispatchCompute(w / 32 , h / 32, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
-    
-    // Buffer with 4 1-byte channels to store the texture data
-    std::vector<uint8_t> img(w * h * numChannels, 1.0);
-    glBindTexture(GL_TEXTURE_2D, outTex);
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, img.data());
-    const char* imgfile = "image.png";
-    stbi_write_png(imgfile, w, h, numChannels /* bytes per pixel */, img.data(), w * numChannels);
-    printf("Image saved to '%s'\n", imgfile);
+    // Print timestamp
+    printf("\n");
+    printf("========== Time execution ================\n");
+    printf("Generation + output = %f ms\n", std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+    printf("==========================================\n");
 
     closeGL();
 
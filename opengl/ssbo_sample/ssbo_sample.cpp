@@ -22,9 +22,12 @@
 #include <numeric>
 #include <chrono>
 #include <algorithm>
+#include <functional>
 
 #include "helper.h"
 #include "gl_helper.h"
+#include "gpu_timer.h"
+#include "trace.h"
 
 // Create an vector of successive value from 1 to 'count'
 std::vector<int> createSuccessiveVector(size_t count)
@@ -59,21 +62,15 @@ void printArrays(const char *msg, const std::vector<int> &arr)
 
 GLuint createSSBO(const std::vector<int> &data, int index /*binding index in shader*/)
 {
-    GLuint ssbo;
-    glGenBuffers(1, &ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-    glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(int) * data.size(), data.data(), GL_DYNAMIC_STORAGE_BIT);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); // unbind
+    GLuint ssbo = createBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(int) * data.size(), data.data(), GL_DYNAMIC_STORAGE_BIT);
+    glState().bindBufferBase(GL_SHADER_STORAGE_BUFFER, index, ssbo);
     GLErrorCheck("SSBO creation");
     return ssbo;
 }
 
 void readSSBO(GLuint ssbo, std::vector<int> &outputs)
 {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(int) * outputs.size(), outputs.data());
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); // unbind
+    getBufferData(GL_SHADER_STORAGE_BUFFER, ssbo, 0, sizeof(int) * outputs.size(), outputs.data());
 }
 
 int times2(const int i) {
@@ -87,16 +84,166 @@ void cpuTimes2Vector(const std::vector<int>& inputs, std::vector<int>& results)
     printf("CPU execution   = %f ms\n", std::chrono::duration<double, std::milli>(tEnd - tStart).count());
 }
 
-int main()
+// Chain of data-dependent kernels: compaction of the inputs that are multiples of 'modulo',
+// then a kernel over the kept elements only. The second dispatch is sized either on the CPU,
+// after reading the count back, or on the GPU by a one-thread kernel writing the arguments
+// of glDispatchComputeIndirect, so that the chain is submitted without waiting for the GPU.
+void benchmarkIndirect(GLuint inputSSBO, const std::vector<int> &inputs, int modulo, int iterations)
 {
-    if (!initGL())
+    const int localSize = 256;
+    GLint maxGroups = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroups);
+    auto kernelDefines = [&](const char *kernel) {
+        return ShaderDefines{{kernel, "1"},
+                             {"LOCAL_SIZE", std::to_string(localSize)},
+                             {"MODULO", std::to_string(modulo)},
+                             {"MAX_WORKGROUPS", std::to_string(maxGroups)}};
+    };
+    auto programs = createComputeShaderVariants("ssbo_indirect.comp", {{"compact", kernelDefines("KERNEL_COMPACT")},
+                                                                       {"args", kernelDefines("KERNEL_DISPATCH_ARGS")},
+                                                                       {"process", kernelDefines("KERNEL_PROCESS")}});
+
+    // Bindings 2 to 5 of ssbo_indirect.comp, the inputs stay on binding 0
+    size_t count = inputs.size();
+    GLuint compactedSSBO = createSSBO(std::vector<int>(count, 0), 2);
+    GLuint counterSSBO = createSSBO(std::vector<int>(1, 0), 3);
+    GLuint processedSSBO = createSSBO(std::vector<int>(count, 0), 4);
+    GLuint argsSSBO = createSSBO(std::vector<int>(3, 1), 5);
+    auto groupsFor = [&](size_t elements) {
+        return static_cast<GLuint>(std::max<size_t>(1, std::min<size_t>((elements + localSize - 1) / localSize, maxGroups)));
+    };
+
+    auto compact = [&]() {
+        clearBufferData(GL_SHADER_STORAGE_BUFFER, counterSSBO);
+        glBarriers().bufferAccess(inputSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+        glBarriers().bufferAccess(compactedSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+        glState().useProgram(programs["compact"]);
+        glDispatchCompute(groupsFor(count), 1, 1);
+        glBarriers().bufferWritten(compactedSSBO);
+        glBarriers().bufferWritten(counterSSBO);
+    };
+    auto beforeProcess = [&]() {
+        glBarriers().bufferAccess(compactedSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+        glBarriers().bufferAccess(counterSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+        glBarriers().bufferAccess(processedSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+        glState().useProgram(programs["process"]);
+    };
+
+    struct Variant
     {
-        fprintf(stderr, "Failed to initialize GL!\n");
-        return 1;
+        const char *name;
+        std::function<double()> run; // Returns the time the CPU waited for the GPU
+    };
+    std::vector<Variant> variants = {
+        {"count read back", [&]() {
+             compact();
+             GLuint kept = 0;
+             auto tStart = std::chrono::high_resolution_clock::now();
+             getBufferData(GL_SHADER_STORAGE_BUFFER, counterSSBO, 0, sizeof(kept), &kept);
+             auto tEnd = std::chrono::high_resolution_clock::now();
+             beforeProcess();
+             glDispatchCompute(groupsFor(kept), 1, 1);
+             glBarriers().bufferWritten(processedSSBO);
+             return std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+         }},
+        {"indirect dispatch", [&]() {
+             compact();
+             glBarriers().bufferAccess(counterSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+             glBarriers().bufferAccess(argsSSBO, GL_SHADER_STORAGE_BARRIER_BIT);
+             glState().useProgram(programs["args"]);
+             glDispatchCompute(1, 1, 1);
+             glBarriers().bufferWritten(argsSSBO);
+             glBarriers().bufferAccess(argsSSBO, GL_COMMAND_BARRIER_BIT);
+             beforeProcess();
+             glState().bindBuffer(GL_DISPATCH_INDIRECT_BUFFER, argsSSBO);
+             glDispatchComputeIndirect(0);
+             glBarriers().bufferWritten(processedSSBO);
+             return 0.0;
+         }},
+    };
+
+    // Expected result
+    size_t expectedKept = 0;
+    long long expectedSum = 0;
+    for (int value : inputs)
+    {
+        if (value % modulo == 0)
+        {
+            ++expectedKept;
+            expectedSum += 2LL * value;
+        }
     }
 
-    printGLInfo();
-    GLTime computeTime;
+    printf("\n");
+    printf("========== Indirect dispatch benchmark (%zu elements, %zu kept, %i iterations) ==========\n", count, expectedKept, iterations);
+    printf("%-20s %12s %12s %12s %14s %8s\n", "variant", "GPU ms", "submit ms", "wall ms", "CPU wait ms", "result");
+    GLTime gpuTime;
+    std::vector<double> wallTimes;
+    for (auto &variant : variants)
+    {
+        variant.run(); // warmup
+        glFinish();
+        double gpuMs = 0.0;
+        double submitMs = 0.0;
+        double wallMs = 0.0;
+        double waitMs = 0.0;
+        for (int i = 0; i < iterations; ++i)
+        {
+            auto tStart = std::chrono::high_resolution_clock::now();
+            gpuTime.start();
+            waitMs += variant.run();
+            gpuTime.end();
+            auto tSubmit = std::chrono::high_resolution_clock::now();
+            glFinish();
+            auto tEnd = std::chrono::high_resolution_clock::now();
+            gpuMs += gpuTime.timeInMs();
+            submitMs += std::chrono::duration<double, std::milli>(tSubmit - tStart).count();
+            wallMs += std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+        }
+
+        // Check the kept elements (in any order, the compaction is not stable)
+        GLuint kept = 0;
+        getBufferData(GL_SHADER_STORAGE_BUFFER, counterSSBO, 0, sizeof(kept), &kept);
+        std::vector<int> processed(kept);
+        if (kept > 0 && kept <= count)
+        {
+            readSSBO(processedSSBO, processed);
+        }
+        long long sum = 0;
+        for (int value : processed)
+        {
+            sum += value;
+        }
+        bool ok = kept == expectedKept && sum == expectedSum;
+
+        printf("%-20s %12f %12f %12f %14f %8s\n", variant.name, gpuMs / iterations, submitMs / iterations,
+               wallMs / iterations, waitMs / iterations, ok ? "OK" : "WRONG");
+        wallTimes.push_back(wallMs / iterations);
+    }
+    printf("Latency saved by the indirect dispatch = %f ms per chain\n", wallTimes[0] - wallTimes[1]);
+    printf("==========================================================================\n");
+
+    GLuint buffers[] = {compactedSSBO, counterSSBO, processedSSBO, argsSSBO};
+    glState().deleteBuffers(4, buffers);
+    for (auto &program : programs)
+    {
+        glState().deleteProgram(program.second);
+    }
+}
+
+// Everything that needs the GL context: the timer queries are released before closeGL()
+int runSample(int argc, char **argv)
+{
+    GPUTimerPool gpuTimers;
+
+    // Optional CPU + GPU timeline (chrome://tracing or https://ui.perfetto.dev)
+    std::string traceFile = getOptionValue(argc, argv, "--trace");
+    TraceRecorder trace;
+    if (!traceFile.empty())
+    {
+        trace.enable();
+        trace.attach(gpuTimers);
+    }
 
     // Compile the compute shader and get its handle
     GLuint computeHandle = createComputeShader("ssbo_sample.comp");
@@ -114,29 +261,87 @@ int main()
     auto tStart = std::chrono::high_resolution_clock::now();
 
     // Create two shader storage objects (one for input and one for output)
-    GLuint inputSSBO = createSSBO(inputs, 0);
-    GLuint outputSSBO = createSSBO(std::vector<int>(inputs.size(), 0), 1);
+    GLuint inputSSBO, outputSSBO;
+    {
+        TraceRecorder::Scope scope(trace, "upload");
+        gpuTimers.begin("upload");
+        inputSSBO = createSSBO(inputs, 0);
+        outputSSBO = createSSBO(std::vector<int>(inputs.size(), 0), 1);
+        gpuTimers.end("upload");
+    }
 
     // Execute the compute shader
-    computeTime.start();
-    glUseProgram(computeHandle);
-    glDispatchCompute(nbIntegers, 1, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
-    computeTime.end();
+    {
+        TraceRecorder::Scope scope(trace, "dispatch");
+        gpuTimers.begin("dispatch");
+        glState().useProgram(computeHandle);
+        glDispatchCompute(nbIntegers, 1, 1);
+        glBarriers().bufferWritten(outputSSBO);
+        gpuTimers.end("dispatch");
+    }
+    {
+        TraceRecorder::Scope scope(trace, "barrier");
+        gpuTimers.begin("barrier");
+        // Only what readSSBO() needs: the buffer read by glGetBufferSubData
+        glBarriers().bufferAccess(outputSSBO, GL_BUFFER_UPDATE_BARRIER_BIT);
+        gpuTimers.end("barrier");
+    }
 
     // Read result back to CPU
-    readSSBO(outputSSBO, outputs);
+    {
+        TraceRecorder::Scope scope(trace, "readback");
+        gpuTimers.begin("readback");
+        readSSBO(outputSSBO, outputs);
+        gpuTimers.end("readback");
+    }
     auto tEnd = std::chrono::high_resolution_clock::now();
     printArrays("outputs", outputs);
 
     // Print timestamp
     printf("\n");
     printf("========== Time execution ================\n");
-    printf("Compute execution = %f ms\n", computeTime.timeInMs());
+    gpuTimers.flush();
+    printf("Compute execution = %f ms\n", gpuTimers.stats()["dispatch"].meanMs);
     printf("Total execution   = %f ms\n", std::chrono::duration<double, std::milli>(tEnd - tStart).count());
     printf("==========================================\n");
+    gpuTimers.print(stdout);
+    glState().print(stdout);
+    glBarriers().print(stdout);
 
-    closeGL();
+    // Data-dependent kernel chain: count read back vs glDispatchComputeIndirect
+    if (hasOption(argc, argv, "--indirect"))
+    {
+        int modulo = std::max(1, atoi(getOptionValue(argc, argv, "--modulo", "3").c_str()));
+        benchmarkIndirect(inputSSBO, inputs, modulo, atoi(getOptionValue(argc, argv, "--iterations", "10").c_str()));
+    }
+
+    glState().deleteBuffers(1, &inputSSBO);
+    glState().deleteBuffers(1, &outputSSBO);
 
+    if (!traceFile.empty())
+    {
+        if (!trace.write(traceFile))
+        {
+            fprintf(stderr, "Failed to write trace '%s'\n", traceFile.c_str());
+            return 1;
+        }
+        printf("Trace written to %s\n", traceFile.c_str());
+    }
     return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (!initGL())
+    {
+        fprintf(stderr, "Failed to initialize GL!\n");
+        return 1;
+    }
+
+    printGLInfo();
+    int result = runSample(argc, argv);
+
+    closeGL();
+
+    return result;
 }
\ No newline at end of file